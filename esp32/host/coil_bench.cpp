@@ -0,0 +1,342 @@
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "input_controller.h"
+#include "kinematic.h"
+#include "menu_system.h"
+#include "orthocyclic_round.h"
+
+#include "sim.h"
+
+/**
+ * Run the reference coil jobs on the simulated board and write the
+ * results as JSON, so the planner versions can be compared.
+ *
+ *     coil_bench [--job name] [--json file.json] [--log level]
+ *
+ * Each job runs in its own process, the simulation is global. The
+ * job reports:
+ *
+ *   job_time_s       the time of the machine (virtual clock)
+ *   wall_s           the host time of the simulation
+ *   rate             the peak (by PEAK_WINDOW steps) and the mean
+ *                    step rate of each axis (steps/s)
+ *   timing_error_us  the time of the major axis steps of the DDA
+ *                    against the ideal profile of their block
+ *   planner          the host CPU time of Kinematic::update (the
+ *                    lookahead, the blocks and the segments) per
+ *                    segment
+ *   r_back_steps     the R steps beyond the net position, the job
+ *                    turns the spindle only forward
+ *
+ * The exit status is non-zero when a job does not complete or its
+ * spindle goes back.
+ */
+
+/** The steps of the window of the peak rate */
+#define PEAK_WINDOW 16
+
+struct BenchJob {
+    const char* name;
+    float wire_od;
+    float bob_len;
+    float bob_id;
+    float bob_od;           // 0 when the turns or the layers are set
+    int turns;
+    int layers;
+    bool continuous;
+};
+
+static const BenchJob jobs[] = {
+    // The job of OrthocyclicRound defaults
+    { "standard", 0.45f, 24.9f, 24.0f, 33.0f, 0, 0, false },
+    { "standard-continuous", 0.45f, 24.9f, 24.0f, 33.0f, 0, 0, true },
+    { "fine-wire", 0.1f, 24.9f, 24.0f, 0, 0, 4, false },
+    { "high-turn", 0.2f, 24.9f, 24.0f, 0, 2000, 0, false },
+    // The layers above the crossover sections wrap to the last one
+    { "high-layer", 0.45f, 24.9f, 24.0f, 0, 0, 16, false },
+    { "high-layer-continuous", 0.45f, 24.9f, 24.0f, 0, 0, 16, true },
+};
+
+#define JOBS_COUNT (int)(sizeof(jobs) / sizeof(jobs[0]))
+
+struct AxisRate {
+    int64_t steps;
+    int64_t first_us;
+    int64_t last_us;
+    int64_t window[PEAK_WINDOW];
+    double peak_rate;
+};
+
+struct TimingError {
+    uint64_t samples;
+    double sum_abs;
+    double sum_sq;
+    double max_abs;
+    // The block of the previous sample
+    bool valid;
+    uint32_t token;
+    steps_t step;
+    int64_t start_us;
+};
+
+struct BenchState {
+    AxisRate rates[2];
+    TimingError error;
+};
+
+static OrthocyclicRound ortho_round;
+static BenchState state;
+
+static void usage() {
+    fprintf(stderr, "usage: coil_bench [--job name] [--json file.json] [--log level]\n");
+    exit(1);
+}
+
+static int64_t thread_cpu_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** The step of the major axis against the ideal time of its block */
+static void measure_timing(int axis, int64_t time_us) {
+    auto& dda = Kinematic::instance.dda;
+    auto& block = dda.block;
+    if (!dda.is_moving() || block.major == 0)
+        return;
+    auto major = abs(block.delta[1]) == block.major ? 1 : 0;
+    if (axis != major)
+        return;
+    auto& e = state.error;
+    auto step = dda.get_block_step();
+    if (step == 0) {
+        // The time of the block starts at its first step
+        e.valid = true;
+        e.token = block.token;
+        e.step = 0;
+        e.start_us = time_us;
+        return;
+    }
+    // The steps of the motor ISR do not advance the block
+    if (!e.valid || e.token != block.token || step <= e.step)
+        return;
+    e.step = step;
+    auto ideal = e.start_us + StepPlanner::ideal_step_time(dda.profile, step) * 1e6;
+    auto error = fabs(time_us - ideal);
+    e.samples++;
+    e.sum_abs += error;
+    e.sum_sq += error * error;
+    if (error > e.max_abs)
+        e.max_abs = error;
+}
+
+static void on_step(int axis, int dir, int64_t time_us, void* ctx) {
+    if (axis > 1)
+        return;
+    auto& rate = state.rates[axis];
+    if (rate.steps == 0)
+        rate.first_us = time_us;
+    rate.last_us = time_us;
+    auto slot = rate.steps % PEAK_WINDOW;
+    if (rate.steps >= PEAK_WINDOW && time_us > rate.window[slot]) {
+        auto peak = PEAK_WINDOW * 1e6 / (time_us - rate.window[slot]);
+        if (peak > rate.peak_rate)
+            rate.peak_rate = peak;
+    }
+    rate.window[slot] = time_us;
+    rate.steps++;
+    measure_timing(axis, time_us);
+}
+
+static void write_rate(FILE* out, const char* name, const AxisRate& rate, bool last) {
+    auto span = rate.last_us - rate.first_us;
+    auto mean = span > 0 ? (rate.steps - 1) * 1e6 / span : 0;
+    fprintf(out, "        \"%s\": { \"steps\": %lld, \"peak\": %.1f, \"mean\": %.1f }%s\n",
+            name, (long long)rate.steps, rate.peak_rate, mean, last ? "" : ",");
+}
+
+/** Run the job and write its JSON object */
+static bool run_job(const BenchJob& job, FILE* out) {
+    auto& kinematic = Kinematic::instance;
+    kinematic.init();
+    auto& xconfig = kinematic.xconfig;
+    auto& rconfig = kinematic.rconfig;
+    sim_watch_axis(0, "X", xconfig.step_pin, xconfig.dir_pin,
+                   xconfig.step_pin_reverse, xconfig.dir_pin_reverse);
+    sim_watch_axis(1, "R", rconfig.step_pin, rconfig.dir_pin,
+                   rconfig.step_pin_reverse, rconfig.dir_pin_reverse);
+    sim_set_step_hook(&on_step, nullptr);
+    MenuSystem::instance.init();
+    MenuSystem::instance.open_menu(MenuSystem::instance.root, 0);
+    kinematic.init_menu(std::string("kinematic"));
+    ortho_round.init_menu("ortho-round");
+
+    ortho_round.wire_od = job.wire_od;
+    ortho_round.bob_len = job.bob_len;
+    ortho_round.bob_id = job.bob_id;
+    ortho_round.bob_od = job.bob_od;
+    ortho_round.wire_turns = job.turns;
+    ortho_round.wire_layers = job.layers;
+    ortho_round.manual_direct = false;
+    ortho_round.continuous = job.continuous;
+    ortho_round.update_config();
+    ortho_round.start();
+    sim_set_key(Button::A, true);
+
+    auto wall_start = std::chrono::steady_clock::now();
+    auto period_us = (int64_t)MOTOR_UPDATE_PERIOD_MS * 1000;
+    auto next_update = sim_time_us();
+    float time = 0;
+    float max_time = 7200;
+    int64_t planner_ns = 0;
+    uint64_t updates = 0;
+    bool complete = true;
+    while (ortho_round.is_winding() || kinematic.is_moving()) {
+        if (time > max_time) {
+            ortho_round.stop();
+            complete = false;
+            break;
+        }
+        next_update += period_us;
+        sim_run_until(next_update);
+        time += (float)MOTOR_UPDATE_PERIOD_MS / 1000.0f;
+        auto cpu_start = thread_cpu_ns();
+        kinematic.update(time);
+        planner_ns += thread_cpu_ns() - cpu_start;
+        updates++;
+        MenuSystem::instance.update(time);
+        ortho_round.update();
+    }
+    sim_shutdown();
+    auto wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+
+    // The spindle winds forward only, each back step makes two extra
+    auto& stats = sim_stats();
+    auto r_back_steps = stats.steps[1] - llabs(stats.position[1]);
+    if (r_back_steps != 0)
+        fprintf(stderr, "The job %s makes %lld R steps for the net %lld\n", job.name,
+                (long long)stats.steps[1], (long long)stats.position[1]);
+
+    auto& e = state.error;
+    auto segments = kinematic.dda.segments_planned;
+    auto samples = e.samples > 0 ? (double)e.samples : 1.0;
+    fprintf(out, "    {\n");
+    fprintf(out, "      \"name\": \"%s\",\n", job.name);
+    fprintf(out, "      \"wire_od\": %.3f, \"bob_len\": %.2f, \"bob_id\": %.2f, \"bob_od\": %.2f,\n",
+            job.wire_od, job.bob_len, job.bob_id, job.bob_od);
+    fprintf(out, "      \"turns\": %d, \"layers\": %d, \"continuous\": %s,\n",
+            job.turns, job.layers, job.continuous ? "true" : "false");
+    fprintf(out, "      \"accel_profile\": %d,\n", (int)xconfig.accel_profile);
+    fprintf(out, "      \"complete\": %s,\n", complete ? "true" : "false");
+    fprintf(out, "      \"r_back_steps\": %lld,\n", (long long)r_back_steps);
+    fprintf(out, "      \"job_time_s\": %.3f,\n", sim_time_us() / 1e6);
+    fprintf(out, "      \"wall_s\": %.3f,\n", wall);
+    fprintf(out, "      \"rate\": {\n");
+    write_rate(out, "X", state.rates[0], false);
+    write_rate(out, "R", state.rates[1], true);
+    fprintf(out, "      },\n");
+    fprintf(out, "      \"timing_error_us\": { \"samples\": %llu, \"mean_abs\": %.3f, \"rms\": %.3f, \"max\": %.3f },\n",
+            (unsigned long long)e.samples, e.sum_abs / samples, sqrt(e.sum_sq / samples), e.max_abs);
+    fprintf(out, "      \"planner\": { \"blocks\": %u, \"segments\": %u, \"updates\": %llu, "
+                 "\"cpu_ms\": %.3f, \"ns_per_segment\": %.1f }\n",
+            (unsigned)kinematic.dda.blocks_pushed, (unsigned)segments,
+            (unsigned long long)updates, planner_ns / 1e6,
+            segments > 0 ? (double)planner_ns / segments : 0.0);
+    fprintf(out, "    }");
+    return complete && r_back_steps == 0;
+}
+
+/** Run the job in the child process, return its JSON object */
+static std::string fork_job(const BenchJob& job, bool& ok) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        exit(1);
+    }
+    fflush(nullptr);
+    auto pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        auto out = fdopen(fds[1], "w");
+        auto passed = run_job(job, out);
+        fclose(out);
+        _exit(passed ? 0 : 2);
+    }
+    close(fds[1]);
+    std::string result;
+    char chunk[1024];
+    ssize_t n;
+    while ((n = read(fds[0], chunk, sizeof(chunk))) > 0)
+        result.append(chunk, n);
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    if (!ok)
+        fprintf(stderr, "The job %s failed (status %d)\n", job.name, status);
+    return result;
+}
+
+int main(int argc, char** argv) {
+    const char* job_name = nullptr;
+    const char* json_path = nullptr;
+    sim_log_level = 0;
+
+    for (auto i = 1; i < argc; i++) {
+        auto arg = argv[i];
+        if (i + 1 >= argc)
+            usage();
+        auto value = argv[++i];
+        if (!strcmp(arg, "--job"))
+            job_name = value;
+        else if (!strcmp(arg, "--json"))
+            json_path = value;
+        else if (!strcmp(arg, "--log"))
+            sim_log_level = atoi(value);
+        else
+            usage();
+    }
+
+    std::string results;
+    auto failed = false;
+    for (auto i = 0; i < JOBS_COUNT; i++) {
+        if (job_name && strcmp(job_name, jobs[i].name))
+            continue;
+        fprintf(stderr, "Run %s\n", jobs[i].name);
+        auto ok = true;
+        auto result = fork_job(jobs[i], ok);
+        failed = failed || !ok;
+        if (result.empty())
+            continue;
+        if (!results.empty())
+            results += ",\n";
+        results += result;
+    }
+    if (results.empty()) {
+        fprintf(stderr, "No job %s\n", job_name ? job_name : "");
+        return 1;
+    }
+
+    auto out = json_path ? fopen(json_path, "w") : stdout;
+    if (out == nullptr) {
+        perror(json_path);
+        return 1;
+    }
+    fprintf(out, "{\n  \"bench\": \"coil\",\n  \"jobs\": [\n%s\n  ]\n}\n", results.c_str());
+    if (out != stdout)
+        fclose(out);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,302 @@
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "config.h"
+#include "input_controller.h"
+#include "kinematic.h"
+#include "menu_system.h"
+#include "motion_trace.h"
+#include "orthocyclic_round.h"
+#include "helical_round.h"
+#include "orthocyclic_rect.h"
+
+#include "sim.h"
+#include "sim_pulse.h"
+
+/**
+ * Wind the orthocyclic (the helical, the rect) coil on the simulated board. The operator
+ * holds the button A for the whole job and the layers reverse
+ * automatically.
+ *
+ *     coil_sim [--wire 0.45] [--bob-len 24.9] [--bob-id 24] [--bob-od 33]
+ *              [--turns N] [--layers N] [--continuous 1] [--max-time sec] [--trace steps.csv]
+ *              [--log level] [--diag 1] [--pulse gpio|fake] [--edges edges.csv]
+ *              [--motion-trace trace.bin] [--program program.bin]
+ *              [--coil ortho|helical|rect] [--size-a 20] [--size-b 10]
+ *              [--corner-r 1] [--wire-v 150] [--modulate 0]
+ *
+ * The fake pulse backend makes the steps as the RMT does (no busy
+ * wait in the ISR) and records the edges of the step pins. The
+ * motion trace is the binary frames as the target writes them to
+ * the console, trace_decode converts them to CSV. The program is
+ * the compiled job, the raw array of the 12 byte records.
+ */
+
+static OrthocyclicRound ortho_round;
+static HelicalRound helical_round;
+static OrthocyclicRect ortho_rect;
+
+static void init_menu() {
+    MenuSystem::instance.init();
+    MenuSystem::instance.open_menu(MenuSystem::instance.root, 0);
+    Kinematic::instance.init_menu(std::string("kinematic"));
+    ortho_round.init_menu("ortho-round");
+    helical_round.init_menu("helical-round");
+    ortho_rect.init_menu("ortho-rect");
+}
+
+static void write_frames(const uint8_t* data, size_t size, void* ctx) {
+    fwrite(data, 1, size, (FILE*)ctx);
+}
+
+static void usage() {
+    fprintf(stderr, "usage: coil_sim [--wire mm] [--bob-len mm] [--bob-id mm] [--bob-od mm]\n"
+                    "                [--turns n] [--layers n] [--continuous 1] [--max-time sec]\n"
+                    "                [--trace file.csv] [--log level] [--diag 1]\n"
+                    "                [--pulse gpio|fake] [--edges file.csv]\n"
+                    "                [--motion-trace file.bin] [--program file.bin]\n"
+                    "                [--coil ortho|helical|rect] [--size-a mm] [--size-b mm]\n"
+                    "                [--corner-r mm] [--wire-v mm/s] [--modulate 0]\n");
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    const char* trace_path = nullptr;
+    const char* edges_path = nullptr;
+    const char* motion_trace_path = nullptr;
+    const char* program_path = nullptr;
+    bool fake_pulse = false;
+    float max_time = 3600;
+    float wire_od = 0.45f;
+    float bob_len = 24.9f;
+    float bob_id = 24.0f;
+    float bob_od = 33.0f;
+    int turns = 0;
+    int layers = 0;
+    bool diag = false;
+    bool continuous = false;
+    bool helical = false;
+    bool rect = false;
+    float size_a = 20;
+    float size_b = 10;
+    float corner_r = 1;
+    float wire_velocity = RECT_WIRE_VELOCITY;
+    bool modulate = true;
+
+    for (auto i = 1; i < argc; i++) {
+        auto arg = argv[i];
+        if (i + 1 >= argc)
+            usage();
+        auto value = argv[++i];
+        if (!strcmp(arg, "--wire"))
+            wire_od = atof(value);
+        else if (!strcmp(arg, "--bob-len"))
+            bob_len = atof(value);
+        else if (!strcmp(arg, "--bob-id"))
+            bob_id = atof(value);
+        else if (!strcmp(arg, "--bob-od"))
+            bob_od = atof(value);
+        else if (!strcmp(arg, "--turns"))
+            turns = atoi(value);
+        else if (!strcmp(arg, "--layers"))
+            layers = atoi(value);
+        else if (!strcmp(arg, "--continuous"))
+            continuous = atoi(value) != 0;
+        else if (!strcmp(arg, "--max-time"))
+            max_time = atof(value);
+        else if (!strcmp(arg, "--trace"))
+            trace_path = value;
+        else if (!strcmp(arg, "--log"))
+            sim_log_level = atoi(value);
+        else if (!strcmp(arg, "--diag"))
+            diag = atoi(value) != 0;
+        else if (!strcmp(arg, "--pulse") && !strcmp(value, "fake"))
+            fake_pulse = true;
+        else if (!strcmp(arg, "--pulse") && !strcmp(value, "gpio"))
+            fake_pulse = false;
+        else if (!strcmp(arg, "--edges"))
+            edges_path = value;
+        else if (!strcmp(arg, "--motion-trace"))
+            motion_trace_path = value;
+        else if (!strcmp(arg, "--program"))
+            program_path = value;
+        else if (!strcmp(arg, "--coil") && !strcmp(value, "helical"))
+            helical = true;
+        else if (!strcmp(arg, "--coil") && !strcmp(value, "rect"))
+            rect = true;
+        else if (!strcmp(arg, "--coil") && !strcmp(value, "ortho"))
+            helical = rect = false;
+        else if (!strcmp(arg, "--size-a"))
+            size_a = atof(value);
+        else if (!strcmp(arg, "--size-b"))
+            size_b = atof(value);
+        else if (!strcmp(arg, "--corner-r"))
+            corner_r = atof(value);
+        else if (!strcmp(arg, "--wire-v"))
+            wire_velocity = atof(value);
+        else if (!strcmp(arg, "--modulate"))
+            modulate = atoi(value) != 0;
+        else
+            usage();
+    }
+
+    FILE* trace = nullptr;
+    if (trace_path) {
+        trace = fopen(trace_path, "w");
+        if (trace == nullptr) {
+            perror(trace_path);
+            return 1;
+        }
+        sim_set_trace(trace);
+    }
+    FILE* motion_trace = nullptr;
+    if (motion_trace_path) {
+        motion_trace = fopen(motion_trace_path, "wb");
+        if (motion_trace == nullptr) {
+            perror(motion_trace_path);
+            return 1;
+        }
+        MotionTrace::instance.enabled = true;
+    }
+
+    // The board as app_main makes it
+    Kinematic::instance.init();
+    auto& xconfig = Kinematic::instance.xconfig;
+    auto& rconfig = Kinematic::instance.rconfig;
+    sim_watch_axis(0, "X", xconfig.step_pin, xconfig.dir_pin,
+                   xconfig.step_pin_reverse, xconfig.dir_pin_reverse);
+    sim_watch_axis(1, "R", rconfig.step_pin, rconfig.dir_pin,
+                   rconfig.step_pin_reverse, rconfig.dir_pin_reverse);
+    SimStepPulse* xpulse = nullptr;
+    SimStepPulse* rpulse = nullptr;
+    if (fake_pulse || edges_path) {
+        xpulse = new SimStepPulse();
+        rpulse = new SimStepPulse();
+        Kinematic::instance.xmotor.hal.set_pulse(xpulse);
+        Kinematic::instance.rmotor.hal.set_pulse(rpulse);
+    }
+    init_menu();
+
+    // The coil job
+    ortho_round.wire_od = wire_od;
+    ortho_round.bob_len = bob_len;
+    ortho_round.bob_id = bob_id;
+    ortho_round.bob_od = turns > 0 || layers > 0 ? 0 : bob_od;
+    ortho_round.wire_turns = turns;
+    ortho_round.wire_layers = layers;
+    ortho_round.manual_direct = false;
+    ortho_round.continuous = continuous;
+    ortho_round.update_config();
+    helical_round.wire_od = wire_od;
+    helical_round.bob_len = bob_len;
+    helical_round.bob_id = bob_id;
+    helical_round.bob_od = ortho_round.bob_od;
+    helical_round.wire_turns = turns;
+    helical_round.wire_layers = layers;
+    helical_round.update_config();
+    ortho_rect.wire_od = wire_od;
+    ortho_rect.bob_len = bob_len;
+    ortho_rect.size_a = size_a;
+    ortho_rect.size_b = size_b;
+    ortho_rect.corner_r = corner_r;
+    ortho_rect.wire_turns = turns;
+    ortho_rect.wire_layers = layers;
+    ortho_rect.wire_velocity = wire_velocity;
+    ortho_rect.modulate = modulate;
+    ortho_rect.update_config();
+    if (program_path) {
+        auto program = fopen(program_path, "wb");
+        if (program == nullptr) {
+            perror(program_path);
+            return 1;
+        }
+        // The job layer by layer, as the winding task compiles it
+        for (auto layer = 1; layer <= ortho_round.layers; layer++) {
+            ortho_round.compile_layer(layer);
+            auto& records = ortho_round.program;
+            fwrite(records.data(), sizeof(WindRecord), records.size(), program);
+        }
+        fclose(program);
+    }
+    if (helical)
+        helical_round.start();
+    else if (rect)
+        ortho_rect.start();
+    else
+        ortho_round.start();
+    sim_set_key(Button::A, true);
+
+    // The main loop of app_main
+    auto wall_start = std::chrono::steady_clock::now();
+    auto period_us = (int64_t)MOTOR_UPDATE_PERIOD_MS * 1000;
+    auto next_update = sim_time_us();
+    float time = 0;
+    while (ortho_round.is_winding() || helical_round.is_winding() || ortho_rect.is_winding() || Kinematic::instance.is_moving()) {
+        if (time > max_time) {
+            fprintf(stderr, "The job does not complete in %.0f s\n", max_time);
+            ortho_round.stop();
+            helical_round.stop();
+            ortho_rect.stop();
+            break;
+        }
+        next_update += period_us;
+        sim_run_until(next_update);
+        time += (float)MOTOR_UPDATE_PERIOD_MS / 1000.0f;
+        Kinematic::instance.update(time);
+        MenuSystem::instance.update(time);
+        ortho_round.update();
+        helical_round.update();
+        ortho_rect.update();
+        if (motion_trace)
+            MotionTrace::instance.drain(&write_frames, motion_trace, MOTION_TRACE_UPDATE_FRAMES);
+    }
+    sim_shutdown();
+    if (motion_trace) {
+        while (MotionTrace::instance.drain(&write_frames, motion_trace, MOTION_TRACE_UPDATE_FRAMES) > 0)
+            ;
+        fclose(motion_trace);
+        if (MotionTrace::instance.dropped > 0)
+            fprintf(stderr, "The motion trace dropped %u records\n", (unsigned)MotionTrace::instance.dropped);
+    }
+    auto wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+
+    auto& stats = sim_stats();
+    auto virtual_time = sim_time_us() / 1e6;
+    unit_t x, r;
+    Kinematic::instance.get_position(x, r);
+    printf("Simulated %.3f s in %.3f s (x%.0f)\n", virtual_time, wall, virtual_time / wall);
+    printf("  Timer events    = %llu\n", (unsigned long long)stats.timer_events);
+    printf("  Task switches   = %llu\n", (unsigned long long)stats.task_switches);
+    printf("  X steps         = %lld (position %lld)\n", (long long)stats.steps[0], (long long)stats.position[0]);
+    printf("  R steps         = %lld (position %lld)\n", (long long)stats.steps[1], (long long)stats.position[1]);
+    printf("  Final position  = X %.3f mm R %.3f turns\n", x, r);
+    printf("  Joint steps     = %llu (X and R by one of %llu GPIO writes)\n",
+           (unsigned long long)stats.joint_steps, (unsigned long long)stats.gpio_writes);
+    if (xpulse) {
+        printf("  X pulses        = %llu (shortest period %lld us)\n",
+               (unsigned long long)xpulse->pulses, (long long)xpulse->shortest_period_us);
+        printf("  R pulses        = %llu (shortest period %lld us)\n",
+               (unsigned long long)rpulse->pulses, (long long)rpulse->shortest_period_us);
+    }
+    if (diag)
+        Kinematic::instance.dump_timing();
+
+    if (edges_path) {
+        auto edges = fopen(edges_path, "w");
+        if (edges == nullptr) {
+            perror(edges_path);
+            return 1;
+        }
+        fprintf(edges, "time_us,axis,level\n");
+        xpulse->write_edges(edges, "X");
+        rpulse->write_edges(edges, "R");
+        fclose(edges);
+    }
+
+    if (trace)
+        fclose(trace);
+    return 0;
+}
@@ -0,0 +1,50 @@
+#ifndef DRIVER_TIMER_H_
+#define DRIVER_TIMER_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/**
+ * The timer group of the simulation. The counter follows the
+ * virtual clock (80 MHz APB / divider), the alarm calls the ISR
+ * callback exactly at its time.
+ */
+
+#define ESP_INTR_FLAG_IRAM (1 << 10)
+
+typedef enum { TIMER_GROUP_0, TIMER_GROUP_1, TIMER_GROUP_MAX } timer_group_t;
+typedef enum { TIMER_0, TIMER_1, TIMER_MAX } timer_idx_t;
+typedef enum { TIMER_PAUSE, TIMER_START } timer_start_t;
+typedef enum { TIMER_ALARM_DIS, TIMER_ALARM_EN, TIMER_ALARM_MAX } timer_alarm_t;
+typedef enum { TIMER_INTR_LEVEL, TIMER_INTR_MAX } timer_intr_mode_t;
+typedef enum { TIMER_COUNT_DOWN, TIMER_COUNT_UP, TIMER_COUNT_MAX } timer_count_dir_t;
+typedef enum { TIMER_AUTORELOAD_DIS, TIMER_AUTORELOAD_EN, TIMER_AUTORELOAD_MAX } timer_autoreload_t;
+
+typedef struct {
+    timer_alarm_t alarm_en;
+    timer_start_t counter_en;
+    timer_intr_mode_t intr_type;
+    timer_count_dir_t counter_dir;
+    timer_autoreload_t auto_reload;
+    uint32_t divider;
+} timer_config_t;
+
+/** Return true to yield at the end of the ISR */
+typedef bool (*timer_isr_t)(void* arg);
+
+esp_err_t timer_init(timer_group_t group, timer_idx_t timer, const timer_config_t* config);
+esp_err_t timer_set_counter_value(timer_group_t group, timer_idx_t timer, uint64_t value);
+esp_err_t timer_get_counter_value(timer_group_t group, timer_idx_t timer, uint64_t* value);
+esp_err_t timer_set_alarm_value(timer_group_t group, timer_idx_t timer, uint64_t value);
+esp_err_t timer_set_alarm(timer_group_t group, timer_idx_t timer, timer_alarm_t alarm_en);
+esp_err_t timer_start(timer_group_t group, timer_idx_t timer);
+esp_err_t timer_pause(timer_group_t group, timer_idx_t timer);
+esp_err_t timer_enable_intr(timer_group_t group, timer_idx_t timer);
+esp_err_t timer_isr_callback_add(timer_group_t group, timer_idx_t timer, timer_isr_t isr_handler,
+                                 void* arg, int intr_alloc_flags);
+uint64_t timer_group_get_counter_value_in_isr(timer_group_t group, timer_idx_t timer);
+void timer_group_set_alarm_value_in_isr(timer_group_t group, timer_idx_t timer, uint64_t value);
+void timer_group_enable_alarm_in_isr(timer_group_t group, timer_idx_t timer);
+
+#endif // DRIVER_TIMER_H_
@@ -0,0 +1,8 @@
+#ifndef ESP_ATTR_H_
+#define ESP_ATTR_H_
+
+/** The host build has no IRAM */
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+#endif // ESP_ATTR_H_
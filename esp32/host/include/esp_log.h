@@ -0,0 +1,14 @@
+#ifndef ESP_LOG_H_
+#define ESP_LOG_H_
+
+#include <stdio.h>
+
+/** The log level of the simulation, 0 disables the info messages */
+extern int sim_log_level;
+
+#define ESP_LOGE(tag, fmt, ...) do { if (sim_log_level >= 1) printf("E %s: " fmt "\n", tag, ##__VA_ARGS__); } while(0)
+#define ESP_LOGW(tag, fmt, ...) do { if (sim_log_level >= 2) printf("W %s: " fmt "\n", tag, ##__VA_ARGS__); } while(0)
+#define ESP_LOGI(tag, fmt, ...) do { if (sim_log_level >= 3) printf("I %s: " fmt "\n", tag, ##__VA_ARGS__); } while(0)
+#define ESP_LOGD(tag, fmt, ...) do { if (sim_log_level >= 4) printf("D %s: " fmt "\n", tag, ##__VA_ARGS__); } while(0)
+
+#endif // ESP_LOG_H_
@@ -0,0 +1,7 @@
+#ifndef ESP_SYSTEM_H_
+#define ESP_SYSTEM_H_
+
+#include "esp_err.h"
+#include "esp_timer.h"
+
+#endif // ESP_SYSTEM_H_
@@ -0,0 +1,31 @@
+#ifndef SOC_GPIO_STRUCT_H_
+#define SOC_GPIO_STRUCT_H_
+
+#include <stdint.h>
+
+/**
+ * The output registers of the simulation. The write of the mask
+ * changes all its pins at once, as w1ts/w1tc of the target do.
+ */
+void sim_gpio_write_mask(int bank, uint32_t mask, int level);
+
+struct sim_gpio_reg {
+    int bank;
+    int level;
+    inline void operator=(uint32_t mask) { sim_gpio_write_mask(bank, mask, level); }
+};
+
+struct sim_gpio_reg1 {
+    sim_gpio_reg val;
+};
+
+struct sim_gpio_dev {
+    sim_gpio_reg out_w1ts;
+    sim_gpio_reg out_w1tc;
+    sim_gpio_reg1 out1_w1ts;
+    sim_gpio_reg1 out1_w1tc;
+};
+
+extern sim_gpio_dev GPIO;
+
+#endif // SOC_GPIO_STRUCT_H_
@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "kinematic.h"
+
+#include "sim.h"
+
+/**
+ * Check the completion of the moves. The moves are queued as the
+ * winding task does: the plain moves, then the geared ones split
+ * by the pitch changes. At each step the move which has not made
+ * its last step yet must not be complete.
+ *
+ * Then the position trigger of R must fire once, right after the
+ * step to its position. The triggers which are never hit fill the
+ * slots before, the stop must drop them.
+ *
+ * The planned move of R is replaced in its cruise: the move the same
+ * way must go on without the gap of the steps, the move back must
+ * stop first. Both come to their targets.
+ *
+ *     motion_check [--log level]
+ *
+ * The exit status is non-zero when any check fails.
+ */
+
+/** The move of the check and its target steps */
+struct CheckMove {
+    move_token_t token;
+    steps_t x;
+    steps_t r;
+    bool geared;                // Only R has the known target
+};
+
+#define CHECK_MOVES_MAX 16
+
+static CheckMove moves[CHECK_MOVES_MAX];
+static int moves_count;
+/** The first move which has not made its last step */
+static int moves_reached;
+static int failures;
+/** The move of the last failure */
+static int failed;
+
+static void usage() {
+    fprintf(stderr, "usage: motion_check [--log level]\n");
+    exit(1);
+}
+
+static void add_move(move_token_t token, unit_t x, unit_t r, bool geared) {
+    auto& move = moves[moves_count++];
+    move.token = token;
+    move.x = Kinematic::instance.xconfig.units_to_steps(x);
+    move.r = Kinematic::instance.rconfig.units_to_steps(r);
+    move.geared = geared;
+}
+
+/** The step is made, the token of its move is not done yet */
+static void on_step(int axis, int dir, int64_t time_us, void* ctx) {
+    if (moves_reached >= moves_count)
+        return;
+    auto& move = moves[moves_reached];
+    if (Kinematic::instance.is_complete(move.token)) {
+        // The first early step of the move is shown
+        if (failures == 0 || moves[failed].token != move.token)
+            printf("  FAIL: move %u is complete before its step at %lld us\n",
+                   (unsigned)move.token, (long long)time_us);
+        failed = moves_reached;
+        failures++;
+    }
+    auto& stats = sim_stats();
+    if (stats.position[1] == move.r && (move.geared || stats.position[0] == move.x))
+        moves_reached++;
+}
+
+/** The position of R seen by the trigger callback */
+static int trigger_hits;
+static int64_t trigger_position;
+
+static void on_trigger(StepMotor* motor, void* arg) {
+    trigger_hits++;
+    trigger_position = sim_stats().position[1];
+}
+
+/** The replaced move keeps its rate this time, then it slows down */
+#define REPLACE_WINDOW_US 200000
+
+/** The steps of R after the replacement of its move */
+static int64_t replace_at;
+static int64_t last_step_us;
+static int last_dir;
+/** The longest interval of the steps right after the replacement */
+static int64_t max_gap;
+/** The interval of the last step before the turn back */
+static int64_t turn_gap;
+
+static void on_replace_step(int axis, int dir, int64_t time_us, void* ctx) {
+    if (axis != 1)
+        return;
+    if (last_step_us > 0 && last_step_us >= replace_at) {
+        auto gap = time_us - last_step_us;
+        if (dir != last_dir)
+            turn_gap = gap;
+        else if (time_us < replace_at + REPLACE_WINDOW_US && gap > max_gap)
+            max_gap = gap;
+    }
+    last_step_us = time_us;
+    last_dir = dir;
+}
+
+/** Run the simulation until the motion stops, or for `sec` */
+static void run(float& time, float sec = 60) {
+    auto& kinematic = Kinematic::instance;
+    auto period_us = (int64_t)MOTOR_UPDATE_PERIOD_MS * 1000;
+    auto next_update = sim_time_us();
+    auto end = time + sec;
+    while (kinematic.is_moving() && time < end) {
+        next_update += period_us;
+        sim_run_until(next_update);
+        time += (float)MOTOR_UPDATE_PERIOD_MS / 1000.0f;
+        kinematic.update(time);
+    }
+}
+
+/** Fire the trigger in the middle of the R move */
+static void check_trigger(float& time) {
+    auto& kinematic = Kinematic::instance;
+    auto& rmotor = kinematic.rmotor;
+    unit_t x, r;
+    kinematic.get_position(x, r);
+    // The triggers behind R, they hold all the slots
+    auto from = rmotor.get_state().position;
+    for (auto i = 0; i <= STEP_TRIGGERS_MAX; i++)
+        rmotor.add_trigger((steps_t)(from - 100 - i), 1, &on_trigger, nullptr);
+    kinematic.move_to(x, r + 0.25f, 100);
+    run(time);
+    kinematic.stop();
+
+    volatile bool flag;
+    auto position = rmotor.get_state().position + 777;
+    rmotor.add_trigger(position, 1, &on_trigger, nullptr, &flag);
+    kinematic.move_to(x, r + 2, 100);
+    run(time);
+
+    printf("Triggers:\n");
+    printf("  Hits            = %d at R %lld (trigger %lld)\n", trigger_hits,
+           (long long)trigger_position, (long long)position);
+    if (trigger_hits != 1 || !flag || trigger_position != position) {
+        printf("  FAIL: the trigger does not fire once at its step\n");
+        failures++;
+    }
+}
+
+/**
+ * Replace the R move in its cruise by `replace` turns from its start,
+ * return true when R comes to the target
+ */
+static bool replace_move(float& time, unit_t replace, const char* name) {
+    auto& rmotor = Kinematic::instance.rmotor;
+    auto& rconfig = Kinematic::instance.rconfig;
+    unit_t velocity = 2;
+    auto from = rmotor.get_state().position;
+    rmotor.move_to((steps_t)(from + rconfig.units_to_steps(4)), velocity);
+    run(time, 0.5f);
+    replace_at = sim_time_us();
+    max_gap = 0;
+    turn_gap = 0;
+    auto target = (steps_t)(from + rconfig.units_to_steps(replace));
+    rmotor.move_to(target, velocity);
+    run(time);
+    auto position = sim_stats().position[1];
+    printf("  %-15s = R %lld (target %lld), max %lld us, turn %lld us\n", name,
+           (long long)position, (long long)target, (long long)max_gap, (long long)turn_gap);
+    return position == target && rmotor.get_state().position == target;
+}
+
+/** Replace the move of R the same way and back */
+static void check_replace(float& time) {
+    auto& rconfig = Kinematic::instance.rconfig;
+    sim_set_step_hook(&on_replace_step, nullptr);
+    // The cruise interval, the replaced move must keep it
+    auto interval = (int64_t)(1000000 / rconfig.units_to_fsteps(2));
+
+    printf("Replace:\n");
+    if (!replace_move(time, 6, "Same way") || max_gap > interval * 3 / 2) {
+        printf("  FAIL: the replaced move does not go on\n");
+        failures++;
+    }
+    if (!replace_move(time, 0.5f, "Back") || turn_gap < interval * 4) {
+        printf("  FAIL: the move back does not stop first\n");
+        failures++;
+    }
+}
+
+/** Queue the moves of the check, as the winding task does */
+static void queue_moves() {
+    auto& kinematic = Kinematic::instance;
+    add_move(kinematic.move_to(2, 1, 100), 2, 1, false);
+    add_move(kinematic.move_to(5, 3, 100), 5, 3, false);
+    add_move(kinematic.move_to(1, 4, 50), 1, 4, false);
+    // The pitch changes split the geared moves to the parts
+    kinematic.add_gear_change(4, 0.45);
+    kinematic.add_gear_change(4.5, 0.3);
+    kinematic.add_gear_change(5.25, 0.15);
+    kinematic.add_gear_change(6.5, 0.45);
+    add_move(kinematic.spin_to(6, 100), 0, 6, true);
+    add_move(kinematic.spin_to(7, 100), 0, 7, true);
+    add_move(kinematic.spin_to(7.5, 100), 0, 7.5, true);
+}
+
+int main(int argc, char** argv) {
+    sim_log_level = 1;
+
+    for (auto i = 1; i < argc; i++) {
+        auto arg = argv[i];
+        if (i + 1 >= argc)
+            usage();
+        auto value = argv[++i];
+        if (!strcmp(arg, "--log"))
+            sim_log_level = atoi(value);
+        else
+            usage();
+    }
+
+    auto& kinematic = Kinematic::instance;
+    kinematic.init();
+    auto& xconfig = kinematic.xconfig;
+    auto& rconfig = kinematic.rconfig;
+    sim_watch_axis(0, "X", xconfig.step_pin, xconfig.dir_pin,
+                   xconfig.step_pin_reverse, xconfig.dir_pin_reverse);
+    sim_watch_axis(1, "R", rconfig.step_pin, rconfig.dir_pin,
+                   rconfig.step_pin_reverse, rconfig.dir_pin_reverse);
+    sim_set_step_hook(&on_step, nullptr);
+
+    kinematic.set_origin();
+    kinematic.set_velocity(0.45, 1);
+    queue_moves();
+
+    float time = 0;
+    run(time);
+
+    printf("Tokens:\n");
+    printf("  Moves           = %d of %d made\n", moves_reached, moves_count);
+    if (moves_reached != moves_count)
+        failures++;
+    for (auto i = 0; i < moves_count; i++) {
+        if (!kinematic.is_complete(moves[i].token)) {
+            printf("  FAIL: move %u is not complete after its steps\n", (unsigned)moves[i].token);
+            failures++;
+        }
+    }
+    check_trigger(time);
+    check_replace(time);
+    sim_shutdown();
+
+    printf("  Failures        = %d\n", failures);
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,657 @@
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "driver/timer.h"
+#include "soc/gpio_struct.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "sim.h"
+
+int sim_log_level = 2;
+
+static int64_t now_us;
+static SimStats stats;
+
+// ==================================================
+// Timers
+// ==================================================
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void* arg;
+    const char* name;
+    int64_t alarm_us;
+    uint64_t period_us;
+    bool armed;
+};
+
+static std::vector<esp_timer*> timers;
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* handle) {
+    auto timer = new esp_timer();
+    timer->callback = args->callback;
+    timer->arg = args->arg;
+    timer->name = args->name;
+    timer->alarm_us = 0;
+    timer->period_us = 0;
+    timer->armed = false;
+    timers.push_back(timer);
+    *handle = timer;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    if (timer->armed)
+        return ESP_ERR_INVALID_STATE;
+    timer->alarm_us = now_us + timeout_us;
+    timer->period_us = 0;
+    timer->armed = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us) {
+    if (timer->armed)
+        return ESP_ERR_INVALID_STATE;
+    timer->alarm_us = now_us + period_us;
+    timer->period_us = period_us;
+    timer->armed = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    if (!timer->armed)
+        return ESP_ERR_INVALID_STATE;
+    timer->armed = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    for (auto it = timers.begin(); it != timers.end(); ++it) {
+        if (*it == timer) {
+            timers.erase(it);
+            break;
+        }
+    }
+    delete timer;
+    return ESP_OK;
+}
+
+int64_t esp_timer_get_time() {
+    return now_us;
+}
+
+void ets_delay_us(uint32_t us) {
+}
+
+// ==================================================
+// Timer groups
+//
+// The alarm of the hardware timer is the esp_timer of the
+// simulation, its callback is the ISR of the timer.
+// ==================================================
+
+struct SimHwTimer {
+    esp_timer_handle_t alarm_timer;
+    timer_isr_t isr;
+    void* arg;
+    uint32_t divider;
+    uint64_t counter;       // at `since_us`
+    int64_t since_us;
+    uint64_t alarm;
+    bool running;
+    bool alarm_en;
+    bool intr_en;
+};
+
+static SimHwTimer hw_timers[TIMER_GROUP_MAX][TIMER_MAX];
+
+static uint64_t hw_counter(SimHwTimer& t) {
+    if (!t.running)
+        return t.counter;
+    return t.counter + (uint64_t)(now_us - t.since_us) * 80 / t.divider;
+}
+
+/** Schedule the alarm by the counter and the divider */
+static void hw_schedule(SimHwTimer& t) {
+    esp_timer_stop(t.alarm_timer);
+    if (!t.running || !t.alarm_en || !t.intr_en || t.isr == nullptr)
+        return;
+    auto now = hw_counter(t);
+    auto ticks = t.alarm > now ? t.alarm - now : 0;
+    esp_timer_start_once(t.alarm_timer, ticks * t.divider / 80);
+}
+
+/** The alarm disables itself, then calls the ISR */
+static void hw_alarm(void* arg) {
+    auto& t = *(SimHwTimer*)arg;
+    t.alarm_en = false;
+    t.isr(t.arg);
+}
+
+esp_err_t timer_init(timer_group_t group, timer_idx_t timer, const timer_config_t* config) {
+    if (group >= TIMER_GROUP_MAX || timer >= TIMER_MAX || config->divider < 2)
+        return ESP_ERR_INVALID_ARG;
+    auto& t = hw_timers[group][timer];
+    if (t.alarm_timer == nullptr) {
+        esp_timer_create_args_t args = {};
+        args.callback = &hw_alarm;
+        args.arg = &t;
+        args.name = "hw-timer";
+        esp_timer_create(&args, &t.alarm_timer);
+    }
+    t.divider = config->divider;
+    t.counter = 0;
+    t.since_us = now_us;
+    t.running = config->counter_en == TIMER_START;
+    t.alarm_en = config->alarm_en == TIMER_ALARM_EN;
+    hw_schedule(t);
+    return ESP_OK;
+}
+
+esp_err_t timer_set_counter_value(timer_group_t group, timer_idx_t timer, uint64_t value) {
+    auto& t = hw_timers[group][timer];
+    t.counter = value;
+    t.since_us = now_us;
+    hw_schedule(t);
+    return ESP_OK;
+}
+
+esp_err_t timer_get_counter_value(timer_group_t group, timer_idx_t timer, uint64_t* value) {
+    *value = hw_counter(hw_timers[group][timer]);
+    return ESP_OK;
+}
+
+esp_err_t timer_set_alarm_value(timer_group_t group, timer_idx_t timer, uint64_t value) {
+    auto& t = hw_timers[group][timer];
+    t.alarm = value;
+    hw_schedule(t);
+    return ESP_OK;
+}
+
+esp_err_t timer_set_alarm(timer_group_t group, timer_idx_t timer, timer_alarm_t alarm_en) {
+    auto& t = hw_timers[group][timer];
+    t.alarm_en = alarm_en == TIMER_ALARM_EN;
+    hw_schedule(t);
+    return ESP_OK;
+}
+
+esp_err_t timer_start(timer_group_t group, timer_idx_t timer) {
+    auto& t = hw_timers[group][timer];
+    t.counter = hw_counter(t);
+    t.since_us = now_us;
+    t.running = true;
+    hw_schedule(t);
+    return ESP_OK;
+}
+
+esp_err_t timer_pause(timer_group_t group, timer_idx_t timer) {
+    auto& t = hw_timers[group][timer];
+    t.counter = hw_counter(t);
+    t.since_us = now_us;
+    t.running = false;
+    hw_schedule(t);
+    return ESP_OK;
+}
+
+esp_err_t timer_enable_intr(timer_group_t group, timer_idx_t timer) {
+    auto& t = hw_timers[group][timer];
+    t.intr_en = true;
+    hw_schedule(t);
+    return ESP_OK;
+}
+
+esp_err_t timer_isr_callback_add(timer_group_t group, timer_idx_t timer, timer_isr_t isr_handler,
+                                 void* arg, int intr_alloc_flags) {
+    auto& t = hw_timers[group][timer];
+    t.isr = isr_handler;
+    t.arg = arg;
+    hw_schedule(t);
+    return ESP_OK;
+}
+
+uint64_t timer_group_get_counter_value_in_isr(timer_group_t group, timer_idx_t timer) {
+    return hw_counter(hw_timers[group][timer]);
+}
+
+void timer_group_set_alarm_value_in_isr(timer_group_t group, timer_idx_t timer, uint64_t value) {
+    timer_set_alarm_value(group, timer, value);
+}
+
+void timer_group_enable_alarm_in_isr(timer_group_t group, timer_idx_t timer) {
+    timer_set_alarm(group, timer, TIMER_ALARM_EN);
+}
+
+// ==================================================
+// Tasks
+//
+// Only one thread runs at a time: the scheduler (the thread
+// which calls sim_run_until) or one of the tasks. The running
+// thread passes the control by `current`.
+// ==================================================
+
+/** Thrown into the task to unwind it when it is deleted */
+struct SimTaskDeleted {};
+
+struct sim_task {
+    std::thread thread;
+    TaskFunction_t code;
+    void* arg;
+    const char* name;
+    int64_t wake_us;
+    bool deleted;
+    bool finished;
+};
+
+static std::mutex lock;
+static std::condition_variable switched;
+static sim_task* current;
+static std::vector<sim_task*> tasks;
+
+/** Give the control to the task and wait until it yields */
+static void resume(sim_task* task) {
+    std::unique_lock<std::mutex> guard(lock);
+    current = task;
+    stats.task_switches++;
+    switched.notify_all();
+    switched.wait(guard, [] { return current == nullptr; });
+}
+
+/** Give the control back to the scheduler (called by the task) */
+static void yield(sim_task* task) {
+    std::unique_lock<std::mutex> guard(lock);
+    current = nullptr;
+    switched.notify_all();
+    switched.wait(guard, [task] { return current == task; });
+    if (task->deleted)
+        throw SimTaskDeleted();
+}
+
+static void task_entry(sim_task* task) {
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        switched.wait(guard, [task] { return current == task; });
+    }
+    try {
+        if (!task->deleted)
+            task->code(task->arg);
+    } catch (SimTaskDeleted&) {
+    }
+    std::unique_lock<std::mutex> guard(lock);
+    task->finished = true;
+    current = nullptr;
+    switched.notify_all();
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char* name, uint32_t stack_depth,
+                       void* arg, UBaseType_t priority, TaskHandle_t* handle) {
+    auto task = new sim_task();
+    task->code = code;
+    task->arg = arg;
+    task->name = name;
+    task->wake_us = now_us;
+    task->deleted = false;
+    task->finished = false;
+    task->thread = std::thread(task_entry, task);
+    tasks.push_back(task);
+    if (handle)
+        *handle = task;
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if (task == nullptr) {
+        if (current == nullptr)
+            return;
+        throw SimTaskDeleted();
+    }
+    // The task unwinds when it gets the control next time
+    task->deleted = true;
+    task->wake_us = now_us;
+}
+
+void vTaskDelay(TickType_t ticks) {
+    // The task polls with zero delay, so it waits at least one
+    // tick or the virtual clock would never advance
+    auto delay_us = (int64_t)(ticks > 0 ? ticks : 1) * portTICK_PERIOD_MS * 1000;
+    auto task = current;
+    if (task == nullptr) {
+        sim_run_until(now_us + delay_us);
+        return;
+    }
+    task->wake_us = now_us + delay_us;
+    yield(task);
+}
+
+void vTaskDelayUntil(TickType_t* previous_wake_time, TickType_t increment) {
+    *previous_wake_time += increment;
+    auto wake_us = (int64_t)*previous_wake_time * portTICK_PERIOD_MS * 1000;
+    auto task = current;
+    if (task == nullptr) {
+        sim_run_until(wake_us);
+        return;
+    }
+    task->wake_us = wake_us;
+    yield(task);
+}
+
+TickType_t xTaskGetTickCount() {
+    return (TickType_t)(now_us / (portTICK_PERIOD_MS * 1000));
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+    static int mutexes;
+    return (SemaphoreHandle_t)(intptr_t)++mutexes;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    return pdTRUE;
+}
+
+// ==================================================
+// The scheduler
+// ==================================================
+
+/** Remove the complete tasks */
+static void join_finished() {
+    for (auto it = tasks.begin(); it != tasks.end(); ) {
+        auto task = *it;
+        if (task->finished) {
+            task->thread.join();
+            delete task;
+            it = tasks.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void sim_run_until(int64_t time_us) {
+    while (true) {
+        // The timers go first at the same time, as the interrupts
+        esp_timer* timer = nullptr;
+        for (auto t : timers) {
+            if (t->armed && t->alarm_us <= time_us && (timer == nullptr || t->alarm_us < timer->alarm_us))
+                timer = t;
+        }
+        sim_task* task = nullptr;
+        for (auto t : tasks) {
+            if (!t->finished && t->wake_us <= time_us && (task == nullptr || t->wake_us < task->wake_us))
+                task = t;
+        }
+        if (timer && (task == nullptr || timer->alarm_us <= task->wake_us)) {
+            if (timer->alarm_us > now_us)
+                now_us = timer->alarm_us;
+            if (timer->period_us > 0)
+                timer->alarm_us += timer->period_us;
+            else
+                timer->armed = false;
+            stats.timer_events++;
+            timer->callback(timer->arg);
+        } else if (task) {
+            if (task->wake_us > now_us)
+                now_us = task->wake_us;
+            resume(task);
+            join_finished();
+        } else {
+            break;
+        }
+    }
+    if (time_us > now_us)
+        now_us = time_us;
+}
+
+void sim_shutdown() {
+    for (auto task : tasks)
+        vTaskDelete(task);
+    while (!tasks.empty()) {
+        resume(tasks.front());
+        join_finished();
+    }
+}
+
+int64_t sim_time_us() {
+    return now_us;
+}
+
+const SimStats& sim_stats() {
+    return stats;
+}
+
+// ==================================================
+// GPIO and the step trace
+// ==================================================
+
+struct SimAxis {
+    const char* name;
+    gpio_num_t step_pin;
+    gpio_num_t dir_pin;
+    bool step_reverse;
+    bool dir_reverse;
+};
+
+static int levels[GPIO_NUM_MAX];
+static SimAxis axes[SIM_AXES_MAX];
+static int axes_count;
+static FILE* trace;
+static sim_step_hook_t step_hook;
+static void* step_hook_ctx;
+/** The steps made by the current register write */
+static int write_steps;
+
+void sim_watch_axis(int axis, const char* name, gpio_num_t step_pin, gpio_num_t dir_pin,
+                    bool step_reverse, bool dir_reverse) {
+    axes[axis].name = name;
+    axes[axis].step_pin = step_pin;
+    axes[axis].dir_pin = dir_pin;
+    axes[axis].step_reverse = step_reverse;
+    axes[axis].dir_reverse = dir_reverse;
+    if (axis >= axes_count)
+        axes_count = axis + 1;
+}
+
+void sim_set_step_hook(sim_step_hook_t hook, void* ctx) {
+    step_hook = hook;
+    step_hook_ctx = ctx;
+}
+
+void sim_set_trace(FILE* file) {
+    trace = file;
+    if (trace)
+        fprintf(trace, "time_us,axis,dir,position\n");
+}
+
+/** The GPIO interrupts, the handler runs at the level change */
+struct SimGpioIntr {
+    gpio_int_type_t type;
+    gpio_isr_t handler;
+    void* arg;
+    bool enabled;
+};
+
+static SimGpioIntr intrs[GPIO_NUM_MAX];
+
+static void on_input(gpio_num_t pin, int old_level, int level) {
+    auto& intr = intrs[pin];
+    if (!intr.enabled || intr.handler == nullptr || old_level == level)
+        return;
+    auto fire = intr.type == GPIO_INTR_ANYEDGE
+        || (intr.type == GPIO_INTR_POSEDGE && level != 0)
+        || (intr.type == GPIO_INTR_NEGEDGE && level == 0);
+    if (fire)
+        intr.handler(intr.arg);
+}
+
+void sim_set_input(gpio_num_t pin, int level) {
+    auto old_level = levels[pin];
+    levels[pin] = level != 0;
+    on_input(pin, old_level, levels[pin]);
+}
+
+/** The endstop switch of the axis */
+struct SimEndstop {
+    gpio_num_t pin;
+    int64_t position;
+    int dir;
+    int active_level;
+    int bounces;
+};
+
+static SimEndstop endstops[SIM_AXES_MAX];
+
+void sim_set_endstop(int axis, gpio_num_t pin, int64_t position, int dir,
+                     int active_level, int bounces) {
+    auto& endstop = endstops[axis];
+    endstop.pin = pin;
+    endstop.position = position;
+    endstop.dir = dir;
+    endstop.active_level = active_level;
+    endstop.bounces = bounces;
+    auto active = (stats.position[axis] - position) * dir >= 0;
+    levels[pin] = active ? active_level : !active_level;
+}
+
+/** The switch follows the position, it bounces at the first contacts */
+static void update_endstop(int i) {
+    auto& endstop = endstops[i];
+    if (endstop.dir == 0)
+        return;
+    auto active = (stats.position[i] - endstop.position) * endstop.dir >= 0;
+    sim_set_input(endstop.pin, active ? endstop.active_level : !endstop.active_level);
+    if (active && endstop.bounces > 0) {
+        endstop.bounces--;
+        sim_set_input(endstop.pin, !endstop.active_level);
+    }
+}
+
+/** Count the step of the axis, the direction is the dir pin */
+static void count_step(int i, int64_t time_us) {
+    auto& axis = axes[i];
+    auto dir = ((levels[axis.dir_pin] != 0) != axis.dir_reverse) ? 1 : -1;
+    if (stats.steps[i]++ == 0)
+        stats.first_step_us[i] = time_us;
+    stats.position[i] += dir;
+    stats.last_step_us[i] = time_us;
+    write_steps++;
+    if (trace)
+        fprintf(trace, "%lld,%s,%d,%lld\n", (long long)time_us, axis.name, dir,
+                (long long)stats.position[i]);
+    if (step_hook)
+        step_hook(i, dir, time_us, step_hook_ctx);
+    update_endstop(i);
+}
+
+/** Count the step at the active edge of the step pin */
+static void on_level(gpio_num_t pin, int old_level, int level) {
+    for (auto i = 0; i < axes_count; i++) {
+        auto& axis = axes[i];
+        if (axis.name == nullptr || axis.step_pin != pin)
+            continue;
+        auto active = (level != 0) != axis.step_reverse;
+        auto was_active = (old_level != 0) != axis.step_reverse;
+        if (active && !was_active)
+            count_step(i, now_us);
+    }
+}
+
+void sim_step_pulse(gpio_num_t step_pin, int64_t rise_us) {
+    for (auto i = 0; i < axes_count; i++) {
+        if (axes[i].name != nullptr && axes[i].step_pin == step_pin)
+            count_step(i, rise_us);
+    }
+}
+
+void gpio_pad_select_gpio(uint8_t gpio_num) {
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode) {
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level) {
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX)
+        return ESP_ERR_INVALID_ARG;
+    auto old_level = levels[gpio_num];
+    levels[gpio_num] = level != 0;
+    if (old_level != levels[gpio_num])
+        on_level(gpio_num, old_level, levels[gpio_num]);
+    return ESP_OK;
+}
+
+sim_gpio_dev GPIO = { {0, 1}, {0, 0}, {{1, 1}}, {{1, 0}} };
+
+void sim_gpio_write_mask(int bank, uint32_t mask, int level) {
+    stats.gpio_writes++;
+    write_steps = 0;
+    for (auto bit = 0; bit < 32; bit++) {
+        auto pin = bank * 32 + bit;
+        if ((mask & ((uint32_t)1 << bit)) == 0 || pin >= GPIO_NUM_MAX)
+            continue;
+        auto old_level = levels[pin];
+        levels[pin] = level;
+        if (old_level != level)
+            on_level((gpio_num_t)pin, old_level, level);
+    }
+    if (write_steps > 1)
+        stats.joint_steps++;
+}
+
+int gpio_get_level(gpio_num_t gpio_num) {
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX)
+        return 0;
+    return levels[gpio_num];
+}
+
+esp_err_t gpio_set_pull_mode(gpio_num_t gpio_num, gpio_pull_mode_t pull) {
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type) {
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX)
+        return ESP_ERR_INVALID_ARG;
+    intrs[gpio_num].type = intr_type;
+    return ESP_OK;
+}
+
+esp_err_t gpio_install_isr_service(int intr_alloc_flags) {
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void* args) {
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX)
+        return ESP_ERR_INVALID_ARG;
+    intrs[gpio_num].handler = isr_handler;
+    intrs[gpio_num].arg = args;
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio_num) {
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX)
+        return ESP_ERR_INVALID_ARG;
+    intrs[gpio_num].handler = nullptr;
+    return ESP_OK;
+}
+
+esp_err_t gpio_intr_enable(gpio_num_t gpio_num) {
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX)
+        return ESP_ERR_INVALID_ARG;
+    intrs[gpio_num].enabled = true;
+    return ESP_OK;
+}
+
+esp_err_t gpio_intr_disable(gpio_num_t gpio_num) {
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX)
+        return ESP_ERR_INVALID_ARG;
+    intrs[gpio_num].enabled = false;
+    return ESP_OK;
+}
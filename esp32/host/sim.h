@@ -0,0 +1,67 @@
+#ifndef SIM_H_
+#define SIM_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "driver/gpio.h"
+
+/** The simulation axes of the step trace */
+#define SIM_AXES_MAX 4
+
+/**
+ * The host simulation of the target. The virtual clock advances
+ * only when all the tasks wait and runs the timers exactly at
+ * their time, so the simulation does not depend on the host load
+ * and runs much faster than real time.
+ */
+
+/** The virtual time (microseconds) */
+int64_t sim_time_us();
+/** Run the timers and the tasks until the time */
+void sim_run_until(int64_t time_us);
+/** Wait until all the tasks complete, then join them */
+void sim_shutdown();
+
+/** Watch the step pin of the axis, the steps go to the trace */
+void sim_watch_axis(int axis, const char* name, gpio_num_t step_pin, gpio_num_t dir_pin,
+                    bool step_reverse, bool dir_reverse);
+/** Count the step made by the pulse backend, not by the GPIO */
+void sim_step_pulse(gpio_num_t step_pin, int64_t rise_us);
+/** Write each step to the CSV file, the null disables */
+void sim_set_trace(FILE* file);
+
+/** The function called for each step (time of the active edge) */
+typedef void (*sim_step_hook_t)(int axis, int dir, int64_t time_us, void* ctx);
+void sim_set_step_hook(sim_step_hook_t hook, void* ctx);
+
+/** Set the level of the input pin, the edge runs its interrupt */
+void sim_set_input(gpio_num_t pin, int level);
+/**
+ * The endstop of the axis: the pin is active when the position
+ * passes the switch in the direction. The first `bounces` contacts
+ * are short spikes.
+ */
+void sim_set_endstop(int axis, gpio_num_t pin, int64_t position, int dir,
+                     int active_level, int bounces = 0);
+
+/** Press or release the button, the encoder turns by delta */
+enum class Button;
+void sim_set_key(Button button, bool pressed);
+void sim_add_delta_position(int delta);
+
+/** The statistics */
+struct SimStats {
+    uint64_t timer_events;
+    uint64_t task_switches;
+    int64_t steps[SIM_AXES_MAX];
+    int64_t position[SIM_AXES_MAX];
+    int64_t first_step_us[SIM_AXES_MAX];
+    int64_t last_step_us[SIM_AXES_MAX];
+    /** The register writes and the ones with the steps of several axes */
+    uint64_t gpio_writes;
+    uint64_t joint_steps;
+};
+const SimStats& sim_stats();
+
+#endif // SIM_H_
@@ -0,0 +1,72 @@
+#include "display.h"
+#include "input_controller.h"
+
+#include "sim.h"
+
+/** ******************************************/
+/** The display and the input of the board   */
+/** ******************************************/
+
+#define SIM_BUTTONS 3
+
+static bool requested[SIM_BUTTONS];
+static bool pressed[SIM_BUTTONS];
+static bool was_pressed[SIM_BUTTONS];
+static int requested_delta;
+static int delta_position;
+
+bool display_init() {
+    return true;
+}
+
+void display_clear() {
+}
+
+void display_set_font(const struct SSD1306_FontDef* font) {
+}
+
+void display_print(const char* text) {
+}
+
+void display_print(int x, int y, const char* text) {
+}
+
+void display_update() {
+}
+
+void sim_set_key(Button button, bool down) {
+    requested[(int)button] = down;
+}
+
+void sim_add_delta_position(int delta) {
+    requested_delta += delta;
+}
+
+void input_controller_init() {
+}
+
+/** Take the requested state once per frame, as the encoder task does */
+void input_controller_update() {
+    for (auto i = 0; i < SIM_BUTTONS; i++) {
+        was_pressed[i] = pressed[i];
+        pressed[i] = requested[i];
+    }
+    delta_position = requested_delta;
+    requested_delta = 0;
+}
+
+bool input_get_key(Button e) {
+    return pressed[(int)e];
+}
+
+bool input_get_key_up(Button e) {
+    return !pressed[(int)e] && was_pressed[(int)e];
+}
+
+bool input_get_key_down(Button e) {
+    return pressed[(int)e] && !was_pressed[(int)e];
+}
+
+int input_get_delta_position() {
+    return delta_position;
+}
@@ -0,0 +1,42 @@
+#include "config.h"
+#include "step_motor_config.h"
+
+#include "sim.h"
+#include "sim_pulse.h"
+
+SimStepPulse::SimStepPulse(size_t _max_edges)
+    : max_edges(_max_edges)
+    , pulses(0)
+    , shortest_period_us(INT64_MAX)
+    , pin(GPIO_NULL)
+    , active(1)
+    , last_rise_us(-1)
+{}
+
+void SimStepPulse::init(StepMotorConfig* config) {
+    pin = config->step_pin;
+    active = config->step_pin_reverse ? 0 : 1;
+}
+
+void SimStepPulse::pulse(uint32_t setup_us) {
+    auto rise_us = sim_time_us() + setup_us;
+    auto fall_us = rise_us + MOTOR_STEP_PULSE_WIDTH_MS;
+    if (last_rise_us >= 0 && rise_us - last_rise_us < shortest_period_us)
+        shortest_period_us = rise_us - last_rise_us;
+    last_rise_us = rise_us;
+    pulses++;
+    if (edges.size() + 2 <= max_edges) {
+        edges.push_back({rise_us, active});
+        edges.push_back({fall_us, !active});
+    }
+    sim_step_pulse(pin, rise_us);
+}
+
+int32_t SimStepPulse::min_period_us() {
+    return MOTOR_STEP_PULSE_WIDTH_MS + 1;
+}
+
+void SimStepPulse::write_edges(FILE* file, const char* axis) {
+    for (auto& edge : edges)
+        fprintf(file, "%lld,%s,%d\n", (long long)edge.time_us, axis, edge.level);
+}
@@ -0,0 +1,47 @@
+#ifndef SIM_PULSE_H_
+#define SIM_PULSE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "step_pulse.h"
+
+/** The edges kept by default */
+#define SIM_PULSE_MAX_EDGES (1 << 20)
+
+/** The edge of the step pin */
+struct SimEdge {
+    int64_t time_us;
+    int level;
+};
+
+/**
+ * The fake hardware-timed pulse backend. It returns at once, as
+ * the RMT does, and records the edges at the time the hardware
+ * would make them.
+ */
+class SimStepPulse : public StepPulse {
+    public:
+        SimStepPulse(size_t max_edges = SIM_PULSE_MAX_EDGES);
+
+        void init(StepMotorConfig* config) override;
+        void pulse(uint32_t setup_us) override;
+        int32_t min_period_us() override;
+
+        /** Write the edges to the CSV file */
+        void write_edges(FILE* file, const char* axis);
+
+        std::vector<SimEdge> edges;
+        size_t max_edges;
+        uint64_t pulses;
+        /** The shortest time between the rising edges */
+        int64_t shortest_period_us;
+
+    private:
+        gpio_num_t pin;
+        int active;
+        int64_t last_rise_us;
+};
+
+#endif // SIM_PULSE_H_
@@ -0,0 +1,102 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "kinematic.h"
+
+#include "sim.h"
+
+/**
+ * Measure the drift of the step rate. The DDA runs one block at
+ * the constant rate: R makes all the steps, X follows it by the
+ * ratio. The time of the steps is compared with the commanded
+ * rate.
+ *
+ *     step_drift [--rate 45000] [--steps 10000] [--ratio 0.3] [--log level]
+ *
+ * X follows by the Bresenham's line, so its count is checked, not
+ * its time. The timer takes whole microseconds, the truncated
+ * interval is shown for the comparison.
+ */
+
+static void usage() {
+    fprintf(stderr, "usage: step_drift [--rate steps/s] [--steps n] [--ratio x/r] [--log level]\n");
+    exit(1);
+}
+
+static void report(const char* name, int axis, steps_t steps, double rate) {
+    auto& stats = sim_stats();
+    auto span = (double)(stats.last_step_us[axis] - stats.first_step_us[axis]);
+    auto expected = (steps - 1) / rate * 1e6;
+    printf("  %s steps         = %lld of %lld\n", name, (long long)stats.steps[axis], (long long)steps);
+    printf("  %s time          = %.0f us (expected %.1f us)\n", name, span, expected);
+    printf("  %s rate error    = %.1f ppm\n", name, (expected / span - 1) * 1e6);
+}
+
+int main(int argc, char** argv) {
+    double rate = 45000;
+    steps_t steps = 10000;
+    double ratio = 0.3;
+    sim_log_level = 1;
+
+    for (auto i = 1; i < argc; i++) {
+        auto arg = argv[i];
+        if (i + 1 >= argc)
+            usage();
+        auto value = argv[++i];
+        if (!strcmp(arg, "--rate"))
+            rate = atof(value);
+        else if (!strcmp(arg, "--steps"))
+            steps = atoi(value);
+        else if (!strcmp(arg, "--ratio"))
+            ratio = atof(value);
+        else if (!strcmp(arg, "--log"))
+            sim_log_level = atoi(value);
+        else
+            usage();
+    }
+    if (rate <= 0 || steps < 2 || ratio < 0 || ratio > 1)
+        usage();
+
+    auto& kinematic = Kinematic::instance;
+    kinematic.init();
+    auto& xconfig = kinematic.xconfig;
+    auto& rconfig = kinematic.rconfig;
+    sim_watch_axis(0, "X", xconfig.step_pin, xconfig.dir_pin,
+                   xconfig.step_pin_reverse, xconfig.dir_pin_reverse);
+    sim_watch_axis(1, "R", rconfig.step_pin, rconfig.dir_pin,
+                   rconfig.step_pin_reverse, rconfig.dir_pin_reverse);
+
+    // The constant rate block, no ramps
+    DdaBlock block;
+    block.delta[0] = (steps_t)lround(steps * ratio);
+    block.delta[1] = steps;
+    block.major = steps;
+    block.token = 1;
+    block.gear = GearRatio{0, 0};
+    kinematic.dda.push(block, (float)rate, 0, (float)rate, (float)rate);
+
+    auto period_us = (int64_t)MOTOR_UPDATE_PERIOD_MS * 1000;
+    auto next_update = sim_time_us();
+    while (kinematic.dda.is_moving()) {
+        next_update += period_us;
+        sim_run_until(next_update);
+        kinematic.dda.update();
+    }
+    sim_shutdown();
+
+    auto exact = 1e6 / rate;
+    auto truncated = floor(exact);
+    printf("Rate %.1f steps/s, interval %.4f us\n", rate, exact);
+    printf("  Step clock max  = %.0f steps/s\n", kinematic.dda.clock->max_rate());
+    if (exact < kinematic.dda.planner.min_interval)
+        printf("  The interval is limited by %d us\n", (int)kinematic.dda.planner.min_interval);
+    report("R", 1, steps, rate);
+    printf("  X/R ratio       = %.6f (commanded %.6f)\n",
+           (double)sim_stats().steps[0] / sim_stats().steps[1], (double)block.delta[0] / steps);
+    printf("  Truncated       = %.0f us interval, %.1f ppm rate error\n",
+           truncated, (exact / truncated - 1) * 1e6);
+    return 0;
+}
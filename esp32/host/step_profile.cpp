@@ -0,0 +1,149 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "step_motor.h"
+#include "step_planner.h"
+
+/**
+ * Compare the step times of the planner segments with the analytic
+ * trapezoid (or S-curve). The move is planned by each profile mode,
+ * its segments are executed as the ISR does: the timer takes whole
+ * microseconds, the fraction carries to the next step. The time of
+ * each step is compared with StepPlanner::ideal_step_time.
+ *
+ *     step_profile [--steps 16000] [--rate 8000] [--accel 32000]
+ *                  [--entry 0] [--exit 0] [--jerk 320000] [--mode all]
+ *                  [--tolerance 100]
+ *
+ * The defaults are the spindle: 10 turns at its max velocity and
+ * acceleration. The jerk goes to the S-curve mode only.
+ *
+ * The exit status is non-zero when any step is off more than the
+ * tolerance (us). By the defaults the steps stay within ~80 us. The
+ * error grows with the step interval, so the slow ramps need more.
+ * The per step ramp from the fractional entry rate starts from the
+ * whole index, it may be off up to half of the entry interval.
+ */
+
+static const char* mode_names[] = { "linear", "per-step", "s-curve" };
+
+static void usage() {
+    fprintf(stderr, "usage: step_profile [--steps n] [--rate steps/s] [--accel steps/s^2]\n"
+                    "                    [--entry steps/s] [--exit steps/s] [--jerk steps/s^3]\n"
+                    "                    [--mode linear|per-step|s-curve|all] [--tolerance us]\n");
+    exit(1);
+}
+
+/** Run the segments of the move, print the error of the step times */
+static bool report(AccelProfile mode, steps_t steps, float rate, float accel,
+                   float entry, float exit_rate, float jerk, double tolerance) {
+    StepPlanner planner;
+    planner.mode = mode;
+    planner.min_interval = STEP_HW_TIMER_MIN_INTERVAL_US;
+    planner.max_interval = MAXIMUM_TIMER_INTERVAL_US;
+    planner.plan(steps, rate, accel, entry, exit_rate, jerk);
+    auto& p = planner.profile;
+
+    StepSegmentQueue queue;
+    StepSegment segment;
+    StepPhase phase;
+    phase.reset();
+    int segments = 0;
+    steps_t n = 0;
+    int64_t time_us = 0;
+    int64_t step_us = 0;
+    double max_error = 0;
+    double sum_error = 0;
+    steps_t max_step = 0;
+    while (true) {
+        segments += planner.fill(queue);
+        if (!queue.pop(segment))
+            break;
+        while (segment.steps > 0) {
+            // The step is made now, the interval is to the next one
+            auto error = time_us - StepPlanner::ideal_step_time(p, n) * 1e6;
+            sum_error += error * error;
+            if (fabs(error) > fabs(max_error)) {
+                max_error = error;
+                max_step = n;
+            }
+            step_us = time_us;
+            n++;
+            time_us += phase.take(segment.interval);
+            segment.advance();
+        }
+    }
+    // The interval after the final step is not waited
+    auto last_us = n > 0 ? StepPlanner::ideal_step_time(p, n - 1) * 1e6 : 0;
+
+    printf("Profile %s:\n", mode_names[(int)mode]);
+    printf("  Steps           = %lld of %lld (%d segments)\n", (long long)n, (long long)steps, segments);
+    printf("  Ramps           = %lld accel, %lld decel steps\n",
+           (long long)p.accel_steps, (long long)p.decel_steps);
+    printf("  Cruise rate     = %.1f steps/s\n", p.cruise_rate);
+    printf("  Move time       = %lld us (analytic %.1f us)\n", (long long)step_us, last_us);
+    printf("  Max error       = %.2f us at step %lld\n", max_error, (long long)max_step);
+    printf("  RMS error       = %.2f us\n", n > 0 ? sqrt(sum_error / n) : 0.0);
+    auto ok = n == steps && fabs(max_error) <= tolerance;
+    if (!ok)
+        printf("  FAIL: the steps are off more than %.2f us\n", tolerance);
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    auto steps_per_turn = MOTOR_STEPS_PER_TURN * MOTOR_R_MICROSTEPS;
+    steps_t steps = 10 * steps_per_turn;
+    float rate = MOTOR_R_MAX_VELOCITY * steps_per_turn;
+    float accel = MOTOR_R_MAX_ACCELERATION * steps_per_turn;
+    float jerk = MOTOR_R_MAX_JERK * steps_per_turn;
+    float entry = 0;
+    float exit_rate = 0;
+    double tolerance = 100;
+    int mode = -1;
+
+    for (auto i = 1; i < argc; i++) {
+        auto arg = argv[i];
+        if (i + 1 >= argc)
+            usage();
+        auto value = argv[++i];
+        if (!strcmp(arg, "--steps"))
+            steps = atoi(value);
+        else if (!strcmp(arg, "--rate"))
+            rate = atof(value);
+        else if (!strcmp(arg, "--accel"))
+            accel = atof(value);
+        else if (!strcmp(arg, "--entry"))
+            entry = atof(value);
+        else if (!strcmp(arg, "--exit"))
+            exit_rate = atof(value);
+        else if (!strcmp(arg, "--jerk"))
+            jerk = atof(value);
+        else if (!strcmp(arg, "--tolerance"))
+            tolerance = atof(value);
+        else if (!strcmp(arg, "--mode")) {
+            mode = -2;
+            for (auto m = 0; m < 3; m++) {
+                if (!strcmp(value, mode_names[m]))
+                    mode = m;
+            }
+            if (!strcmp(value, "all"))
+                mode = -1;
+            if (mode == -2)
+                usage();
+        } else
+            usage();
+    }
+    if (steps < 1 || rate <= 0 || accel < 0 || entry < 0 || exit_rate < 0 || jerk < 0 || tolerance < 0)
+        usage();
+
+    auto failed = false;
+    for (auto m = 0; m < 3; m++) {
+        if ((mode < 0 || mode == m) &&
+            !report((AccelProfile)m, steps, rate, accel, entry, exit_rate, jerk, tolerance))
+            failed = true;
+    }
+    return failed ? 1 : 0;
+}
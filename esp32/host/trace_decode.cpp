@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "motion_trace.h"
+#include "step_planner.h"
+
+/**
+ * Decode the binary motion trace to CSV. The input is the raw
+ * console capture (or the coil_sim --motion-trace file), the text
+ * between the frames and the broken frames are skipped.
+ *
+ *     trace_decode trace.bin [--csv trace.csv] [--plot trace.gp]
+ *
+ * The plot is the gnuplot script of the step rate and the position
+ * of each axis over the time, it reads the CSV.
+ */
+
+static const char* axis_names[] = { "X", "R", "DDA", "K" };
+static const char* event_names[] = {
+    "segment", "move", "done", "halt", "endstop", "trigger", "homing", "block", "command", "stop"
+};
+
+static void usage() {
+    fprintf(stderr, "usage: trace_decode trace.bin [--csv file.csv] [--plot file.gp]\n");
+    exit(1);
+}
+
+static const char* name_of(const char** names, int size, int i) {
+    return i >= 0 && i < size ? names[i] : "?";
+}
+
+/** The rate of the segment (steps/s), the sign is the direction */
+static double segment_rate(const TraceRecord& rec) {
+    if (rec.value == 0)
+        return 0;
+    return 1e6 * STEP_INTERVAL_ONE / rec.value;
+}
+
+static void write_plot(FILE* out, const char* csv_path) {
+    fprintf(out, "set datafile separator ','\n");
+    fprintf(out, "set multiplot layout 2,1\n");
+    fprintf(out, "set xlabel 'time (s)'\n");
+    fprintf(out, "set ylabel 'rate (steps/s)'\n");
+    fprintf(out, "plot for [a in 'X R DDA'] '%s' using ($1/1e6):(strcol(2) eq a && strcol(3) eq 'segment' ? $7 : 1/0) "
+                 "with steps title a\n", csv_path);
+    fprintf(out, "set ylabel 'position (steps)'\n");
+    fprintf(out, "plot for [a in 'X R'] '%s' using ($1/1e6):(strcol(2) eq a ? $5 : 1/0) "
+                 "with lines title a\n", csv_path);
+    fprintf(out, "unset multiplot\n");
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2)
+        usage();
+    const char* input_path = argv[1];
+    const char* csv_path = nullptr;
+    const char* plot_path = nullptr;
+    for (auto i = 2; i < argc; i++) {
+        auto arg = argv[i];
+        if (i + 1 >= argc)
+            usage();
+        auto value = argv[++i];
+        if (!strcmp(arg, "--csv"))
+            csv_path = value;
+        else if (!strcmp(arg, "--plot"))
+            plot_path = value;
+        else
+            usage();
+    }
+
+    auto input = strcmp(input_path, "-") ? fopen(input_path, "rb") : stdin;
+    if (input == nullptr) {
+        perror(input_path);
+        return 1;
+    }
+    std::vector<uint8_t> data;
+    uint8_t chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), input)) > 0)
+        data.insert(data.end(), chunk, chunk + n);
+    if (input != stdin)
+        fclose(input);
+
+    auto csv = csv_path ? fopen(csv_path, "w") : stdout;
+    if (csv == nullptr) {
+        perror(csv_path);
+        return 1;
+    }
+    fprintf(csv, "time_us,axis,event,arg,position,value,rate\n");
+
+    // The time of the target wraps after 71 minutes
+    int64_t epoch = 0;
+    uint32_t last_time = 0;
+    uint64_t frames = 0, records = 0, bad = 0, dropped = 0;
+    size_t pos = 0;
+    while (pos + MOTION_TRACE_HEADER_SIZE + 2 <= data.size()) {
+        auto frame = &data[pos];
+        if (frame[0] != MOTION_TRACE_MAGIC0 || frame[1] != MOTION_TRACE_MAGIC1
+            || frame[2] != MOTION_TRACE_VERSION || frame[3] > MOTION_TRACE_FRAME_RECORDS) {
+            pos++;
+            continue;
+        }
+        auto count = frame[3];
+        auto size = MOTION_TRACE_HEADER_SIZE + count * sizeof(TraceRecord);
+        if (pos + size + 2 > data.size())
+            break;
+        auto crc = (uint16_t)(frame[size] | (frame[size + 1] << 8));
+        if (MotionTrace::crc16(frame, size) != crc) {
+            bad++;
+            pos++;
+            continue;
+        }
+        frames++;
+        dropped += frame[4] | (frame[5] << 8);
+        for (auto i = 0; i < count; i++) {
+            TraceRecord rec;
+            memcpy(&rec, frame + MOTION_TRACE_HEADER_SIZE + i * sizeof(TraceRecord), sizeof(rec));
+            if (records > 0 && rec.time_us < last_time && last_time - rec.time_us > 0x80000000u)
+                epoch += (int64_t)1 << 32;
+            last_time = rec.time_us;
+            auto rate = rec.event == (uint8_t)TraceEvent::Segment ? segment_rate(rec) : 0;
+            fprintf(csv, "%lld,%s,%s,%u,%d,%d,%.1f\n", (long long)(epoch + rec.time_us),
+                    name_of(axis_names, 4, rec.axis), name_of(event_names, 10, rec.event),
+                    (unsigned)rec.arg, (int)rec.position, (int)rec.value, rate);
+            records++;
+        }
+        pos += size + 2;
+    }
+    if (csv != stdout)
+        fclose(csv);
+
+    if (plot_path) {
+        auto plot = fopen(plot_path, "w");
+        if (plot == nullptr) {
+            perror(plot_path);
+            return 1;
+        }
+        write_plot(plot, csv_path ? csv_path : "trace.csv");
+        fclose(plot);
+    }
+    fprintf(stderr, "%llu frames, %llu records, %llu broken frames, %llu dropped records\n",
+            (unsigned long long)frames, (unsigned long long)records,
+            (unsigned long long)bad, (unsigned long long)dropped);
+    return 0;
+}
@@ -99,11 +99,43 @@ RectCoil::RectCoil ()
     : Coil()
     , size_a(10)
     , size_b(10)
+    , corner_r(1)
+    , bob_len(10)
 {
 
 }
 
 
-void RectCoil::init_menu(std::string path) {
-    // TODO
+void RectCoil::init_menu(std::string path)
+{
+    Coil::init_menu(path);
+
+    auto menu = MenuSystem::instance.get_or_create(path);
+    // Edit settings
+    menu->add(new FloatItem(menu, "size-a",
+                            [&] () -> float { return size_a; },
+                            [&] (float v) { size_a = v; }));
+    menu->get_last<FloatItem>().set_step(1).set_precision(1);
+    menu->add(new FloatItem(menu, "size-b",
+                            [&] () -> float { return size_b; },
+                            [&] (float v) { size_b = v; }));
+    menu->get_last<FloatItem>().set_step(1).set_precision(1);
+    menu->add(new FloatItem(menu, "corner-r",
+                            [&] () -> float { return corner_r; },
+                            [&] (float v) { corner_r = v < 0 ? 0 : v; }));
+    menu->get_last<FloatItem>().set_step(1).set_precision(1);
+    menu->add(new FloatItem(menu, "bob-len",
+                            [&] () -> float { return bob_len; },
+                            [&] (float v) { bob_len = v; }));
+    menu->get_last<FloatItem>().set_step(1).set_precision(1);
+}
+
+void RectCoil::inspect()
+{
+    Coil::inspect();
+    printf("Rect coil:\n");
+    printf("  Bobin size A     = %.2f mm\n", size_a);
+    printf("  Bobin size B     = %.2f mm\n", size_b);
+    printf("  Corner radius    = %.2f mm\n", corner_r);
+    printf("  Bobin length     = %.2f mm\n", bob_len);
 }
@@ -55,20 +55,18 @@ class RectCoil : public Coil
                 RectCoil();
 
                 virtual void init_menu(std::string path);
+                virtual void inspect();
 
                 float size_a;
                 float size_b;
+                float corner_r;
+                float bob_len;
 };
 
 /** *******************************************************************/
 /** (((((((((((((((((((((((((( HELOCAL COIL ))))))))))))))))))))))))))*/
 /** *******************************************************************/
 
-/** Helical round coil */
-class HelicalRound : public RoundCoil {
-        // TODO
-};
-
 /** Helical rectangular coil */
 class HelicalRect : public RectCoil {
         // TODO
@@ -43,6 +43,12 @@ extern float g_speed;
 #define MOTOR_STEP_PULSE_WIDTH_MS 2
 #define MOTOR_DIR_PULSE_DELAY_MS 2
 #define MOTOR_ENABLE_PULSE_DELAY_MS 10
+/** The endstop must stay active this time after its edge (us) */
+#define MOTOR_ENDSTOP_FILTER_US 200
+/** The homing checks the endstop again this time after the stop (ms) */
+#define MOTOR_ENDSTOP_DEBOUNCE_MS 5
+/** The homing pass restarts after the endstop glitch */
+#define MOTOR_HOMING_ATTEMPTS 3
 
 #define MOTOR_X_STEP_PIN GPIO_NUM_25
 #define MOTOR_X_DIR_PIN GPIO_NUM_26
@@ -52,6 +58,10 @@ extern float g_speed;
 #define MOTOR_X_DIR_PIN_REVERSE 1
 #define MOTOR_X_ENABLE_PIN_REVERSE 1
 #define MOTOR_X_ENDSTOP_PIN_REVERSE 0
+#define MOTOR_X_STEP_PULSE 1 /*0 gpio busy-wait, 1 rmt*/
+#define MOTOR_X_RMT_CHANNEL 0
+#define MOTOR_X_STEP_CLOCK 0 /*0 esp_timer, 1 hardware timer*/
+#define MOTOR_X_HW_TIMER 0 /*group * 2 + timer*/
 #define MOTOR_X_MAX_VELOCITY 20/*mm/s*/
 #define MOTOR_X_MAX_ACCELERATION (MOTOR_X_MAX_VELOCITY*4) /*mm/s^2* usualy velocity x 5*/
 #define MOTOR_X_ROTATION_DISTANCE 2/*mm*/
@@ -63,6 +73,10 @@ extern float g_speed;
 #define MOTOR_X_HOMING_RETRACT_DIST 5
 #define MOTOR_X_SECOND_HOMING_SPEED 5
 #define MOTOR_X_HOMING_DIR (-1)
+#define MOTOR_X_USE_PLANNER 1
+#define MOTOR_X_ACCEL_PROFILE 1 /*0 linear segments, 1 per step ramp, 2 s-curve*/
+#define MOTOR_X_MAX_JERK (MOTOR_X_MAX_ACCELERATION*10)/*mm/s^3 for s-curve*/
+#define MOTOR_X_JUNCTION_VELOCITY 5/*mm/s the velocity jump between moves*/
 
 #define MOTOR_R_STEP_PIN GPIO_NUM_27
 #define MOTOR_R_DIR_PIN GPIO_NUM_14
@@ -72,6 +86,10 @@ extern float g_speed;
 #define MOTOR_R_DIR_PIN_REVERSE 1
 #define MOTOR_R_ENABLE_PIN_REVERSE 1
 #define MOTOR_R_ENDSTOP_PIN_REVERSE 0
+#define MOTOR_R_STEP_PULSE 1 /*0 gpio busy-wait, 1 rmt*/
+#define MOTOR_R_RMT_CHANNEL 1
+#define MOTOR_R_STEP_CLOCK 1 /*0 esp_timer, 1 hardware timer*/
+#define MOTOR_R_HW_TIMER 1 /*group * 2 + timer*/
 #define MOTOR_R_MAX_VELOCITY 5/*turns/s*/
 #define MOTOR_R_MAX_ACCELERATION (MOTOR_R_MAX_VELOCITY*4)/*turns/s^2 usualy velocity x 5*/
 #define MOTOR_R_ROTATION_DISTANCE 1/*turn*/
@@ -83,6 +101,12 @@ extern float g_speed;
 #define MOTOR_R_HOMING_RETRACT_DIST 5
 #define MOTOR_R_SECOND_HOMING_SPEED 5
 #define MOTOR_R_HOMING_DIR (-1)
+#define MOTOR_R_USE_PLANNER 1
+#define MOTOR_R_ACCEL_PROFILE 1 /*0 linear segments, 1 per step ramp, 2 s-curve*/
+#define MOTOR_R_MAX_JERK (MOTOR_R_MAX_ACCELERATION*10)/*turns/s^3 for s-curve*/
+#define MOTOR_R_JUNCTION_VELOCITY 0.5/*turns/s the velocity jump between moves*/
+/** The DDA takes the hardware timer when any of its axes does */
+#define DDA_HW_TIMER 2 /*group * 2 + timer*/
 
 // ==============================================================
 // ROTARY ENCODER
@@ -106,8 +130,21 @@ extern float g_speed;
 #define STOP_BEFORE_TURNS 2
 /** For manual direction allow this extra turns */
 #define ALLOW_EXTRA_TURNS 10
+/** The lowest feed of the planned move (factor of the nominal) */
 #define MINIMUM_SPEED_FACTOR 0.2
-#define INCREASE_SPEED_EACH_N_TURNS 2
-#define INCREASE_SPEED_STEP 0.2
+/** The wire acceleration the tensioner holds (mm/s^2) */
+#define WIRE_TENSION_ACCEL 1000
+/** The winding task plans ahead this amount of turns by their tokens */
+#define WINDING_TURNS_AHEAD 4
+/** The helical coil reverses X at the flange in this turns */
+#define HELICAL_REVERSAL_TURNS 0.5
+/** The pitch steps of the each half of the reversal */
+#define HELICAL_REVERSAL_STEPS 4
+/** The entries of the spindle velocity table per turn of the rect coil */
+#define RECT_VELOCITY_LUT_SIZE 32
+/** The crossover of the rect coil turn, the entries of the table */
+#define RECT_CROSS_ENTRIES 4
+/** The default wire velocity limit of the rect coil (mm/s) */
+#define RECT_WIRE_VELOCITY 150
 
 #endif // CONFIG_H_
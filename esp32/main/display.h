@@ -1,5 +1,8 @@
 #pragma once
 
+/** The characters of the line, the default font on the 128 px display */
+#define DISPLAY_COLUMNS 16
+
 bool display_init();
 void display_clear();
 void display_set_font(const struct SSD1306_FontDef* font);
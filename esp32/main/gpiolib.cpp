@@ -1,3 +1,9 @@
+#include "esp_attr.h"
+#ifdef ESP_PLATFORM
+#include "hal/gpio_ll.h"
+#endif
+#include "soc/gpio_struct.h"
+
 #include "gpiolib.h"
 #include "config.h"
 
@@ -51,3 +57,35 @@ void toggle_gpio(gpio_num_t pin)
 }
 
 
+
+/** Write the pins of the batch, one register write per bank and level */
+void IRAM_ATTR commit_gpio(const GpioBatch& batch)
+{
+  if (batch.set[0])
+    GPIO.out_w1ts = batch.set[0];
+  if (batch.clear[0])
+    GPIO.out_w1tc = batch.clear[0];
+  if (batch.set[1])
+    GPIO.out1_w1ts.val = batch.set[1];
+  if (batch.clear[1])
+    GPIO.out1_w1tc.val = batch.clear[1];
+}
+
+/** Write the pin by the set or clear register */
+void IRAM_ATTR write_gpio(gpio_num_t pin, int value)
+{
+  GpioBatch batch;
+  batch.reset();
+  batch.write(pin, value);
+  commit_gpio(batch);
+}
+
+/** Read the level of the pin by the input register */
+int IRAM_ATTR read_gpio(gpio_num_t pin)
+{
+#ifdef ESP_PLATFORM
+  return gpio_ll_get_level(&GPIO, pin);
+#else
+  return gpio_get_level(pin);
+#endif
+}
@@ -1,8 +1,13 @@
 #ifndef GPIO_TOOLS_H_
 #define GPIO_TOOLS_H_
 
+#include <stdint.h>
 #include <driver/gpio.h>
 
+#include "esp_attr.h"
+
+#include "config.h"
+
 void set_gpio_mode(gpio_num_t gpionum, gpio_mode_t gpiomode, int gpioval);
 void set_gpio_oc(gpio_num_t pin);
 void set_gpio_out(gpio_num_t pin);
@@ -10,6 +15,47 @@ void set_gpio_in(gpio_num_t pin);
 bool set_gpio(gpio_num_t pin, int value);
 void toggle_gpio(gpio_num_t pin);
 
+/**
+ * The pins written together. The pins 0..31 and 32..39 are two
+ * banks, the bits go to the set (w1ts) and clear (w1tc) registers
+ * of the bank. So the pins changing to the same level change by
+ * one register write.
+ */
+struct GpioBatch {
+  uint32_t set[2];
+  uint32_t clear[2];
+
+  IRAM_ATTR inline void reset() {
+    set[0] = set[1] = clear[0] = clear[1] = 0;
+  }
+  IRAM_ATTR inline bool is_empty() const {
+    return (set[0] | set[1] | clear[0] | clear[1]) == 0;
+  }
+  IRAM_ATTR inline void write(gpio_num_t pin, int value) {
+    if (pin == GPIO_NULL)
+      return;
+    auto bit = (uint32_t)1 << (pin & 31);
+    if (value)
+      set[pin >> 5] |= bit;
+    else
+      clear[pin >> 5] |= bit;
+  }
+  /** The batch which returns the pins back */
+  IRAM_ATTR inline GpioBatch inverse() const {
+    GpioBatch b;
+    b.set[0] = clear[0];
+    b.set[1] = clear[1];
+    b.clear[0] = set[0];
+    b.clear[1] = set[1];
+    return b;
+  }
+};
+
+void commit_gpio(const GpioBatch& batch);
+/** Write and read the pin by the registers, the driver calls are in flash (ISR safe) */
+void write_gpio(gpio_num_t pin, int value);
+int read_gpio(gpio_num_t pin);
+
 
 
 #endif // GPIO_TOOLS_H_
@@ -0,0 +1,246 @@
+#include <cstdio>
+#include <math.h>
+
+#include "coil.h"
+#include "config.h"
+#include "display.h"
+#include "helical_round.h"
+#include "input_controller.h"
+#include "kinematic.h"
+#include "mathlib.h"
+#include "menu_event.h"
+#include "menu_export.h"
+#include "menu_item.h"
+#include "menu_system.h"
+
+static const char TAG[] = "helical-coil";
+
+/** The constructor */
+HelicalRound::HelicalRound()
+    : RoundCoil()
+    , reversal_turns(HELICAL_REVERSAL_TURNS)
+    , speed(100)
+    , layers(0)
+    , layer_turns(0)
+    , total_turns(0)
+    , winding_len(0)
+    , winding_h(0)
+    , coil_od(0)
+    , winding_task_handle(NULL)
+    , run(false)
+{
+    wire_od = 0.45;
+    bob_len = 24.9;
+    bob_id = 24.0;
+    bob_od = 33.0;
+}
+
+/** Update with fixed frequency */
+void HelicalRound::update()
+{
+    if (version != menu->get_version())
+        update_config();
+
+    if (is_winding()) {
+        if (MenuSystem::instance.is_visible) {
+            if (input_get_key_up(Button::A) || input_get_key_up(Button::B))
+                MenuSystem::instance.set_visible(false);
+            run = false;
+        } else {
+            // The layer goes while the button A is held
+            run = input_get_key(Button::A);
+        }
+    }
+}
+
+void HelicalRound::init_menu(std::string path)
+{
+    RoundCoil::init_menu(path);
+
+    // Editable settings
+    menu = MenuSystem::instance.get_or_create(path);
+    menu->add(new FloatItem(menu, "reversal",
+                            [&] () -> float { return reversal_turns; },
+                            [&] (float v) { reversal_turns = v < 0 ? 0 : v; }));
+    menu->get_last<FloatItem>().set_step(1).set_precision(2);
+    menu->add(new IntItem(menu, "speed",
+                          [&] () -> int { return speed; },
+                          [&] (int v) { speed = v < 1 ? 1 : (v > 100 ? 100 : v); }));
+    // Read only settings
+    menu->add(new IntItem(menu, "-layers", [&] () -> int { return layers; }, nullptr));
+    menu->add(new FloatItem(menu, "-turns-l", [&] () -> float { return layer_turns; }, nullptr));
+    menu->add(new FloatItem(menu, "-coil-od", [&] () -> float { return coil_od; }, nullptr));
+    menu->add(new FloatItem(menu, "-wind-l", [&] () -> float { return winding_len; }, nullptr));
+    menu->add(new FloatItem(menu, "-wind-h", [&] () -> float { return winding_h; }, nullptr));
+    // Actions
+    menu->add(new ActionItem(menu, "start", [&] (MenuItem* it, MenuEvent e) { start(); }));
+    menu->add(new ActionItem(menu, "stop", [&] (MenuItem* it, MenuEvent e) { stop(); }));
+}
+
+static void display_status(float turn, float turns, int layer, int layers, float rpm)
+{
+    MenuSystem::instance.set_visible(false);
+    display_clear();
+    // The values are clamped, so the line fits the display
+    char buf[DISPLAY_COLUMNS + 1];
+    std::snprintf(buf, sizeof(buf), "T: %d/%d",
+                  (int)CLAMP(turn, 0.0f, 99999.0f), (int)CLAMP(turns, 0.0f, 99999.0f));
+    display_print(0,0, buf);
+    std::snprintf(buf, sizeof(buf), "L: %d/%d F%d", CLAMP(layer, 0, 999),
+                  CLAMP(layers, 0, 999), (int)CLAMP(rpm, 0.0f, 999.0f));
+    display_print(0,1, buf);
+    display_update();
+}
+
+/**
+ * Queue the pitch schedule of the layer from the R position `start`.
+ * The half of the reversal ramps the pitch up in the steps, the
+ * helix goes with the full pitch, then the other half ramps it down
+ * to the flange. The average pitch of the ramp is the half of the
+ * full one, so X travels the winding length exactly. The changes
+ * after the end of the job are not queued.
+ */
+bool HelicalRound::schedule_layer(float start, float pitch, float end)
+{
+    auto& kinematic = Kinematic::instance;
+    auto n = HELICAL_REVERSAL_STEPS;
+    auto half = fminf(reversal_turns / 2, layer_turns / 2);
+    auto ok = true;
+    auto change = [&](float r, float p) {
+        if (r < end)
+            ok = kinematic.add_gear_change(r, p) && ok;
+    };
+    if (half > 0) {
+        for (auto k = 0; k < n; k++)
+            change(start + half * k / n, pitch * (k + 0.5f) / n);
+    }
+    change(start + half, pitch);
+    if (half > 0) {
+        auto ramp = start + layer_turns - half;
+        for (auto k = 0; k < n; k++)
+            change(ramp + half * k / n, pitch * (n - k - 0.5f) / n);
+    }
+    return ok;
+}
+
+/**
+ * Wind the layers. The spindle moves turn by turn, so the operator
+ * can pause the winding by releasing the button A, but the moves
+ * join without stops and X follows the schedule of the layer.
+ */
+void HelicalRound::process()
+{
+    MenuSystem::instance.set_visible(false);
+
+    // Make current position as (0,0), X moves the wire per turn
+    Kinematic::instance.set_origin();
+    Kinematic::instance.set_velocity(wire_od, 1);
+
+    // The tokens of the turns in flight, the oldest one is waited
+    move_token_t ahead[WINDING_TURNS_AHEAD] = {};
+    auto n = 0;
+    auto turn = 0.0f;
+    for (auto layer = 1; layer<=layers && turn < total_turns; layer++) {
+        auto pitch = (layer & 1) ? wire_od : -wire_od;
+        auto start = (layer - 1) * layer_turns;
+        auto end = fminf(start + layer_turns, total_turns);
+        ESP_LOGI(TAG, "Layer %d turns [%f .. %f] pitch %f", layer, start, end, pitch);
+        if (!schedule_layer(start, pitch, end)) {
+            ESP_LOGE(TAG, "The pitch %f can not be geared", pitch);
+            break;
+        }
+        while (turn < end) {
+            // Plan ahead only few turns, so the winding does
+            // not run away when the operator releases button
+            auto& token = ahead[n++ % WINDING_TURNS_AHEAD];
+            Kinematic::instance.wait(token);
+            while (!run)
+                vTaskDelay(1/portTICK_PERIOD_MS);
+
+            turn = fminf(floorf(turn) + 1, end);
+            display_status(turn, total_turns, layer, layers, speed);
+            token = Kinematic::instance.spin_to(turn, speed);
+        }
+    }
+    // The last turn completes the job
+    Kinematic::instance.wait(ahead[(n + WINDING_TURNS_AHEAD - 1) % WINDING_TURNS_AHEAD]);
+    printf("\nCOMPLETE %d LAYERS AND %.2f TURNS\n", layers, turn);
+    winding_task_handle = NULL;
+    vTaskDelete(NULL);
+}
+
+#define WINDING_TASK_PRIO 2
+
+static void c_helical_task(void* arg)
+{
+    ((HelicalRound*)arg)->process();
+}
+
+/** Start winding process */
+void HelicalRound::start()
+{
+    if (is_winding()) {
+        ESP_LOGW(TAG,"The coild is already winding");
+    } else {
+        ESP_LOGI(TAG, "Start winding task");
+        inspect();
+        xTaskCreate(c_helical_task, "helical_task", 4096, this, WINDING_TASK_PRIO, &winding_task_handle);
+    }
+}
+
+void HelicalRound::stop() {
+    if (is_winding()) {
+        ESP_LOGI(TAG,"Stop winding");
+        vTaskDelete(winding_task_handle);
+        winding_task_handle = NULL;
+        Kinematic::instance.stop();
+    }
+}
+
+void HelicalRound::update_config() {
+    version = menu->get_version();
+    // The wire center goes from one flange to other
+    winding_len = bob_len - wire_od;
+    auto helix_turns = winding_len / wire_od;
+    layer_turns = helix_turns + reversal_turns / 2;
+
+    if (wire_layers > 0) {
+        // Make coil based on target layers
+        layers = wire_layers;
+        total_turns = layers * layer_turns;
+    } else if (bob_od > 0) {
+        // Make the coil based on target external diameter
+        layers = (int)floorf((bob_od - bob_id) / (2 * wire_od));
+        layers = layers < 1 ? 1 : layers;
+        total_turns = layers * layer_turns;
+    } else {
+        // Make coil based on the total amout of turns
+        layers = (int)ceilf(wire_turns / layer_turns);
+        total_turns = wire_turns;
+    }
+    // The helical layers do not nest
+    winding_h = layers * wire_od;
+    coil_od = bob_id + (2 * winding_h);
+    // Display result
+    inspect();
+}
+
+/**
+ * Print all settings to the  terminal
+ **/
+void HelicalRound::inspect()
+{
+    RoundCoil::inspect();
+    printf("Helical coil:\n");
+    // Print the arguments
+    printf("  Reversal        = %.2f turns\n", reversal_turns);
+    printf("  Speed           = %d %%\n", speed);
+    // Computed parameters
+    printf("Helical computed:\n");
+    printf("  Total Turns     = %.2f\n", total_turns);
+    printf("  Layers num      = %d\n", layers);
+    printf("  Layer turns     = %.2f\n", layer_turns);
+    printf("  Winding len     = %.2f mm\n", winding_len);
+    printf("  Winding H       = %.2f mm\n", winding_h);
+    printf("  Coil OD         = %.2f mm\n", coil_od);
+}
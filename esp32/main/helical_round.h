@@ -0,0 +1,58 @@
+#ifndef HELICAL_ROUND_H_
+#define HELICAL_ROUND_H_
+
+#include <string>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "coil.h"
+
+/** *******************************************************************/
+/** (((((((((((((((((((((((((( HELICAL ROUND )))))))))))))))))))))))))) */
+/** *******************************************************************/
+
+/**
+ * Helical round coil. Each layer is one helix: the spindle turns
+ * continuously and X follows it by the gear, one wire per turn.
+ * At the flange the pitch ramps down and the next layer ramps it
+ * up in the other direction.
+ */
+class HelicalRound : public RoundCoil
+{
+    public:
+
+        HelicalRound();
+
+        void init_menu(std::string path);
+        void start();
+        void stop();
+        void update();
+        void update_config();
+        void inspect();
+        void process();
+
+        inline bool is_winding() { return winding_task_handle != NULL; }
+
+        // The turns of the whole reversal at the flange
+        float reversal_turns;
+        // The spindle speed (percents)
+        int speed;
+
+        int layers;
+        float layer_turns;
+        float total_turns;
+        float winding_len;
+        float winding_h;
+        float coil_od;
+
+    private:
+
+        bool schedule_layer(float start, float pitch, float end);
+
+        /** Thread */
+        TaskHandle_t winding_task_handle;
+        volatile bool run;
+};
+
+#endif // HELICAL_ROUND_H_
@@ -4,6 +4,7 @@
 
 #include "config.h"
 #include "kinematic.h"
+#include "motion_trace.h"
 #include "mathlib.h"
 #include "menu_export.h"
 #include "menu_item.h"
@@ -12,17 +13,28 @@
 
 static const char TAG[] = "kinematic";
 
+/** The axes geometry of config.h, folded at compile time */
+typedef StepUnits<step_units_steps(MOTOR_X_MICROSTEPS * MOTOR_STEPS_PER_TURN, MOTOR_X_ROTATION_DISTANCE),
+                  step_units_units(MOTOR_X_MICROSTEPS * MOTOR_STEPS_PER_TURN, MOTOR_X_ROTATION_DISTANCE)> XUnits;
+typedef StepUnits<step_units_steps(MOTOR_R_MICROSTEPS * MOTOR_STEPS_PER_TURN, MOTOR_R_ROTATION_DISTANCE),
+                  step_units_units(MOTOR_R_MICROSTEPS * MOTOR_STEPS_PER_TURN, MOTOR_R_ROTATION_DISTANCE)> RUnits;
+
 Kinematic Kinematic::instance;
 
 static bool motors_enabled;
 
 Kinematic::Kinematic()
-    : rvelocity_k(0.7f)
+    : raccel_limit(0)
+    , rvelocity_k(0.7f)
     , log(0)
+    , last_token(0)
+    , current_pending(false)
     , curent_speed(1)
     , target_speed(1)
     , speed_acc(1)
 {
+    gear_ratio.num = 0;
+    gear_ratio.den = 1;
 }
 
 void Kinematic::init()
@@ -38,6 +50,10 @@ void Kinematic::init()
     xconfig.step_pin_reverse = MOTOR_X_STEP_PIN_REVERSE;
     xconfig.enable_pin_reverse = MOTOR_X_ENABLE_PIN_REVERSE;
     xconfig.endstop_pin_reverse = MOTOR_X_ENDSTOP_PIN_REVERSE;
+    xconfig.pulse_type = (StepPulseType)MOTOR_X_STEP_PULSE;
+    xconfig.pulse_channel = MOTOR_X_RMT_CHANNEL;
+    xconfig.clock_type = (StepClockType)MOTOR_X_STEP_CLOCK;
+    xconfig.clock_index = MOTOR_X_HW_TIMER;
     // Kinematic
     xconfig.max_velocity = MOTOR_X_MAX_VELOCITY;
     xconfig.max_accel = MOTOR_X_MAX_ACCELERATION;
@@ -51,6 +67,10 @@ void Kinematic::init()
     xconfig.homing_retract_dist = MOTOR_X_HOMING_RETRACT_DIST;
     xconfig.second_homing_speed = MOTOR_X_SECOND_HOMING_SPEED;
     xconfig.homing_dir = MOTOR_X_HOMING_DIR;
+    xconfig.use_planner = MOTOR_X_USE_PLANNER;
+    xconfig.accel_profile = (AccelProfile)MOTOR_X_ACCEL_PROFILE;
+    xconfig.max_jerk = MOTOR_X_MAX_JERK;
+    xconfig.junction_velocity = MOTOR_X_JUNCTION_VELOCITY;
 
     /** R motor */
     rconfig.id = 1;
@@ -62,6 +82,10 @@ void Kinematic::init()
     rconfig.dir_pin_reverse = MOTOR_R_DIR_PIN_REVERSE;
     rconfig.step_pin_reverse = MOTOR_R_STEP_PIN_REVERSE;
     rconfig.enable_pin_reverse = MOTOR_R_ENABLE_PIN_REVERSE;
+    rconfig.pulse_type = (StepPulseType)MOTOR_R_STEP_PULSE;
+    rconfig.pulse_channel = MOTOR_R_RMT_CHANNEL;
+    rconfig.clock_type = (StepClockType)MOTOR_R_STEP_CLOCK;
+    rconfig.clock_index = MOTOR_R_HW_TIMER;
     // Kinematic
     rconfig.max_velocity = MOTOR_R_MAX_VELOCITY;
     rconfig.max_accel = MOTOR_R_MAX_ACCELERATION;
@@ -75,9 +99,18 @@ void Kinematic::init()
     rconfig.homing_retract_dist = MOTOR_R_HOMING_RETRACT_DIST;
     rconfig.second_homing_speed = MOTOR_R_SECOND_HOMING_SPEED;
     rconfig.homing_dir = MOTOR_R_HOMING_DIR;
+    rconfig.use_planner = MOTOR_R_USE_PLANNER;
+    rconfig.accel_profile = (AccelProfile)MOTOR_R_ACCEL_PROFILE;
+    rconfig.max_jerk = MOTOR_R_MAX_JERK;
+    rconfig.junction_velocity = MOTOR_R_JUNCTION_VELOCITY;
     // Initialize motors
     xmotor.init(&xconfig);
     rmotor.init(&rconfig);
+    dda.init(&xmotor, &rmotor);
+    get_default_velocity(xvelocity, rvelocity);
+    // Configure look-ahead planner
+    planner.junction_rate[0] = xconfig.units_to_fsteps(xconfig.junction_velocity);
+    planner.junction_rate[1] = rconfig.units_to_fsteps(rconfig.junction_velocity);
 
     motors_enabled = true;
     Kinematic::instance.xmotor.set_enable(motors_enabled);
@@ -90,7 +123,7 @@ void Kinematic::update(float time) {
     auto dt = time - old_time;
     old_time = time;
 
-    if (xmotor.is_moving() || rmotor.is_moving()) {
+    if (is_moving()) {
         auto dif = target_speed-curent_speed;
         // If the motors are works make
         // interpolation of speed
@@ -110,6 +143,9 @@ void Kinematic::update(float time) {
     rmotor.speed = target_speed;
     xmotor.update(time);
     rmotor.update(time);
+    dda.update();
+    plan_commands();
+    execute_blocks();
 
     if (log>3) {
         ESP_LOGI(TAG, "movx:%d movr:%d vx:%f vr:%f px:%f pr:%f",
@@ -129,15 +165,26 @@ static void toggle_drivers(MenuItem* item, MenuEvent evt) {
     Kinematic::instance.rmotor.set_enable(motors_enabled);
 }
 
-static void start_homing_task(MenuItem* item, MenuEvent evt) {
-    Kinematic::instance.xmotor.move_to_home();
+static void start_homing(MenuItem* item, MenuEvent evt) {
+    Kinematic::instance.home();
+}
+
+/** The read only statistics of the step timer */
+static void add_timing_menu(Menu* menu, std::string name, StepTiming& timing)
+{
+    menu->add(new IntItem(menu, "-" + name + "-missed",
+                          [&timing]()->int{ return (int)timing.missed; }, nullptr));
+    menu->add(new IntItem(menu, "-" + name + "-late",
+                          [&timing]()->int{ return timing.max_late; }, nullptr));
+    menu->add(new IntItem(menu, "-" + name + "-isr",
+                          [&timing]()->int{ return timing.max_isr; }, nullptr));
 }
 
 void Kinematic::init_menu(std::string path)
 {
     auto menu = MenuSystem::instance.root;
     menu->add(new ActionItem(menu, "m-onoff", &toggle_drivers));
-    menu->add(new ActionItem(menu, "homing", &start_homing_task));
+    menu->add(new ActionItem(menu, "homing", &start_homing));
     xmotor.init_menu("mot-x");
     rmotor.init_menu("mot-r");
 
@@ -148,6 +195,33 @@ void Kinematic::init_menu(std::string path)
     kmenu->add(new FloatItem(menu, "rvel-k",
                             [&]()->float{return rvelocity_k;},
                             [&](float v) { rvelocity_k = v; }));
+    kmenu->add(new IntItem(menu, "dda-log",
+                            [&]()->int{return dda.log;},
+                            [&](int v) {dda.log = v; }));
+
+    // The step timer diagnostics
+    auto diag = MenuSystem::instance.get_or_create("diag");
+    add_timing_menu(diag, "x", xmotor.timing);
+    add_timing_menu(diag, "r", rmotor.timing);
+    add_timing_menu(diag, "dda", dda.timing);
+    // The binary motion trace to the console
+    diag->add(new IntItem(diag, "trace",
+                          []()->int { return MotionTrace::instance.enabled ? 1 : 0; },
+                          [](int v) { MotionTrace::instance.enabled = v != 0; }));
+    diag->add(new ActionItem(diag, "dump", [&] (MenuItem* it, MenuEvent e) { dump_timing(); }));
+    diag->add(new ActionItem(diag, "reset", [&] (MenuItem* it, MenuEvent e) {
+        xmotor.timing.reset();
+        rmotor.timing.reset();
+        dda.timing.reset();
+    }));
+}
+
+/** Print the step timer statistics to the terminal */
+void Kinematic::dump_timing()
+{
+    xmotor.timing.dump("X");
+    rmotor.timing.dump("R");
+    dda.timing.dump("DDA");
 }
 
 void Kinematic::set_velocity(unit_t dx, unit_t dr)
@@ -155,6 +229,19 @@ void Kinematic::set_velocity(unit_t dx, unit_t dr)
     get_default_velocity(xvelocity,rvelocity);
     rvelocity = xvelocity * (dr / dx) * rvelocity_k;
     ESP_LOGI(TAG, "Set velicity for dX:%f dR:%f vX:%f vR:%f", dx, dr, xvelocity, rvelocity);
+    // The job sets its own limit after the velocity
+    raccel_limit = 0;
+}
+
+/**
+ * Limit the spindle acceleration below the motor one, the wire
+ * tension of the coil allows less. The moves planned after the
+ * call take the limit.
+ */
+void Kinematic::set_accel_limit(unit_t r)
+{
+    raccel_limit = r;
+    ESP_LOGI(TAG, "Set acceleration limit aR:%f", r);
 }
 
 void Kinematic::get_default_velocity(unit_t& x, unit_t& r)
@@ -171,8 +258,9 @@ void Kinematic::get_velocity(unit_t& x, unit_t& r)
 
 void Kinematic::get_position(unit_t& x, unit_t& r)
 {
-    x = xmotor.get_position();
-    r = rmotor.get_position();
+    // The snapshots are consistent, the ISR does not wait
+    x = XUnits::to_units(xmotor.get_state().position);
+    r = RUnits::to_units(rmotor.get_state().position);
 }
 
 void Kinematic::set_origin()
@@ -181,17 +269,222 @@ void Kinematic::set_origin()
     rmotor.set_origin();
 }
 
-void  Kinematic::move_to(unit_t tgtx, unit_t tgtr, percents_t rpm)
+/**
+ * The move passes the stages from the commands to the motors, each
+ * stage takes it before the previous one drops it. So the stages
+ * are read in the same order, the move in transit is always seen.
+ */
+bool Kinematic::is_moving()
+{
+    return !commands.is_empty() || current_pending || !planner.is_empty()
+        || dda.is_moving() || xmotor.is_moving() || rmotor.is_moving();
+}
+
+/**
+ * Home the axes with the endstop in parallel, update() advances
+ * the homing of each motor
+ */
+bool Kinematic::home()
+{
+    stop();
+    auto started = false;
+    if (xconfig.endstop_pin != GPIO_NULL)
+        started = xmotor.move_to_home() || started;
+    if (rconfig.endstop_pin != GPIO_NULL)
+        started = rmotor.move_to_home() || started;
+    return started;
+}
+
+bool Kinematic::is_homing()
+{
+    return xmotor.is_homing() || rmotor.is_homing();
+}
+
+/** Wait until all planned moves complete */
+void Kinematic::synchronize()
+{
+    while (is_moving())
+        vTaskDelay(1/portTICK_PERIOD_MS);
+}
+
+/** Drop all planned moves and the position triggers */
+void Kinematic::stop()
 {
-    ESP_LOGI(TAG, "move_to X:%f R:%f F:%f", tgtx, tgtr, rpm);
+    xmotor.stop_homing();
+    rmotor.stop_homing();
+    commands.clear();
+    current_pending = false;
+    gear_changes.clear();
+    gear_ratio.num = 0;
+    planner.clear();
+    dda.stop();
+    xmotor.clear_triggers();
+    rmotor.clear_triggers();
+    gear_planned.reset();
+    MotionTrace::instance.record(TraceAxis::Kinematic, TraceEvent::Stop, 0);
+}
 
+/** The moves queued, planned or executing */
+int Kinematic::queue_size()
+{
+    return commands.size() + (current_pending ? 1 : 0) + planner.size() + dda.blocks_in_flight();
+}
+
+/**
+ * The move is complete. The moves without steps complete
+ * together with the next move or when the motion stops.
+ */
+bool Kinematic::is_complete(move_token_t token)
+{
+    return (int32_t)(dda.token_done - token) >= 0 || !is_moving();
+}
+
+/** Wait until the move complete */
+void Kinematic::wait(move_token_t token)
+{
+    while (!is_complete(token))
+        vTaskDelay(1/portTICK_PERIOD_MS);
+}
+
+/**
+ * Queue the move and return immediately. Wait only when the
+ * command buffer is full. The returned token tells when the
+ * move is complete.
+ */
+move_token_t Kinematic::move_to(unit_t tgtx, unit_t tgtr, percents_t rpm)
+{
+    if (log > 0)
+        ESP_LOGI(TAG, "move_to X:%f R:%f F:%f", tgtx, tgtr, rpm);
+
+    MoveCommand cmd;
+    cmd.x = tgtx;
+    cmd.r = tgtr;
+    cmd.rpm = rpm;
+    cmd.token = last_token + 1;
+    cmd.geared = false;
+    while (!commands.push(cmd))
+        vTaskDelay(1/portTICK_PERIOD_MS);
+    last_token = cmd.token;
+    MotionTrace::instance.record(TraceAxis::Kinematic, TraceEvent::Command,
+                                 xconfig.units_to_steps(cmd.x), rconfig.units_to_steps(cmd.r),
+                                 (uint16_t)cmd.token);
+    return cmd.token;
+}
+
+/**
+ * Queue the move of R, X follows it by the pitch schedule. The
+ * spindle runs the whole move continuously, the move splits only
+ * at the pitch changes.
+ */
+move_token_t Kinematic::spin_to(unit_t tgtr, percents_t rpm)
+{
+    if (log > 0)
+        ESP_LOGI(TAG, "spin_to R:%f F:%f", tgtr, rpm);
+
+    MoveCommand cmd;
+    cmd.x = 0;
+    cmd.r = tgtr;
+    cmd.rpm = rpm;
+    cmd.token = last_token + 1;
+    cmd.geared = true;
+    while (!commands.push(cmd))
+        vTaskDelay(1/portTICK_PERIOD_MS);
+    last_token = cmd.token;
+    MotionTrace::instance.record(TraceAxis::Kinematic, TraceEvent::Command,
+                                 xconfig.units_to_steps(cmd.x), rconfig.units_to_steps(cmd.r),
+                                 (uint16_t)cmd.token);
+    return cmd.token;
+}
+
+/**
+ * From the R position `r` the geared X moves `pitch` units per R
+ * unit. The changes go in the order of the R motion and before
+ * the move which crosses them. Wait when the schedule is full.
+ */
+bool Kinematic::add_gear_change(unit_t r, unit_t pitch)
+{
+    GearChange change;
+    change.position = RUnits::to_steps(r);
+    if (!pitch_to_ratio(pitch, change.ratio)) {
+        ESP_LOGE(TAG, "The pitch %f is too big for the gear", pitch);
+        return false;
+    }
+    while (!gear_changes.push(change))
+        vTaskDelay(1/portTICK_PERIOD_MS);
+    return true;
+}
+
+/**
+ * The exact X steps per R step of the pitch. The pitch is rounded
+ * to STEP_UNITS_SCALE, then the ratio is the integer fraction.
+ * Return false when X must step faster than R.
+ */
+bool Kinematic::pitch_to_ratio(unit_t pitch, GearRatio& ratio)
+{
+    auto scaled = (int64_t)(pitch * STEP_UNITS_SCALE + (pitch < 0 ? -0.5f : 0.5f));
+    auto num = scaled * XUnits::steps * RUnits::units;
+    auto den = (int64_t)STEP_UNITS_SCALE * XUnits::units * RUnits::steps;
+    auto a = num < 0 ? -num : num;
+    auto b = den;
+    while (b != 0) {
+        auto t = a % b;
+        a = b;
+        b = t;
+    }
+    if (a > 1) {
+        num /= a;
+        den /= a;
+    }
+    if ((num < 0 ? -num : num) > den)
+        return false;
+    ratio.num = (int32_t)num;
+    ratio.den = (int32_t)den;
+    return true;
+}
+
+/** Convert the queued commands to the look-ahead blocks */
+void Kinematic::plan_commands()
+{
+    while (!planner.is_full()) {
+        if (!current_pending) {
+            if (commands.is_empty())
+                break;
+            current = commands.front();
+            current_pending = true;
+            commands.pop(current);
+        }
+        if (plan_move(current))
+            current_pending = false;
+    }
+}
+
+/**
+ * Give the planned blocks to the executor. Only few blocks
+ * ahead, the rest stays in the look-ahead buffer where the
+ * junctions can be replanned when the new moves come.
+ */
+void Kinematic::execute_blocks()
+{
+    MotionBlock block;
+    float entry_rate, exit_rate;
+    while (dda.blocks_in_flight() < MOTION_BLOCKS_AHEAD && !dda.is_planning()) {
+        if (!planner.peek(block, entry_rate, exit_rate))
+            break;
+        dda.push(block.dda, block.nominal_rate, block.accel, entry_rate, exit_rate, block.jerk);
+        planner.pop(block, entry_rate, exit_rate);
+    }
+}
+
+/** Plan the move or its part, return true when it is planned whole */
+bool Kinematic::plan_move(const MoveCommand& cmd)
+{
     // set target speed
-    target_speed = clamp01(rpm/100.0f);
+    target_speed = clamp01(cmd.rpm/100.0f);
     // estimate the speed's acceleration
     auto oldr = rmotor.get_position();
     auto oldx = xmotor.get_position();
-    auto difr = (tgtr-oldr);
-    auto difx = (tgtx-oldx);
+    auto difr = (cmd.r-oldr);
+    auto difx = cmd.geared ? 0 : (cmd.x-oldx);
     auto est_durationr = difr / rvelocity;
     auto est_durationx = difx / xvelocity;
     auto max_dur = max(est_durationr, est_durationx);
@@ -204,9 +497,74 @@ void  Kinematic::move_to(unit_t tgtx, unit_t tgtr, percents_t rpm)
     }
     // TODO! Fix code abowe
 //    speed_acc = 0.5;
-    xmotor.move_to(tgtx,xvelocity);
-    rmotor.move_to(tgtr,rvelocity);
 
-    while (xmotor.is_moving() || rmotor.is_moving())
-        vTaskDelay(1/portTICK_PERIOD_MS);
+    // The new move starts where the planned one ends
+    if (planner.is_empty() && !dda.is_moving()) {
+        xplanned = xmotor.get_state().position;
+        rplanned = rmotor.get_state().position;
+    }
+    if (!cmd.geared) {
+        // Both axes share the single step clock
+        auto dx = XUnits::to_steps(cmd.x) - xplanned;
+        auto dr = RUnits::to_steps(cmd.r) - rplanned;
+        gear_planned.reset();
+        plan_block(dx, dr, cmd.token, GearRatio{0, 0});
+        return true;
+    }
+
+    // The pitch changes at or behind the position take effect now
+    auto rtarget = RUnits::to_steps(cmd.r);
+    auto dir = rtarget >= rplanned ? 1 : -1;
+    GearChange change;
+    while (!gear_changes.is_empty() && (rplanned - gear_changes.front().position) * dir >= 0) {
+        gear_changes.pop(change);
+        gear_ratio = change.ratio;
+    }
+    // The block ends at the next change
+    auto end = rtarget;
+    if (!gear_changes.is_empty() && (rtarget - gear_changes.front().position) * dir > 0)
+        end = gear_changes.front().position;
+    auto dr = end - rplanned;
+    if (dr == 0)
+        return true;
+    // The same steps of X as the DDA makes
+    if (!gear_planned.is_same(gear_ratio))
+        gear_planned.set(gear_ratio);
+    auto dx = gear_planned.advance(dr);
+    // Only the last part completes the move, the parts before it
+    // carry the token of the previous move
+    auto last = end == rtarget;
+    plan_block(dx, dr, last ? cmd.token : cmd.token - 1, gear_ratio);
+    return last;
+}
+
+/** Add the block to the look-ahead planner */
+bool Kinematic::plan_block(steps_t dx, steps_t dr, move_token_t token, GearRatio gear)
+{
+    auto major = (float)max(abs(dx), abs(dr));
+    if (major == 0)
+        return false;
+    // The move takes the time of the slowest axis
+    auto speed = max(target_speed, (float)MINIMUM_SPEED_FACTOR);
+    auto xrate = xconfig.units_to_fsteps(min(abs(xvelocity), xconfig.max_velocity) * speed);
+    auto rrate = rconfig.units_to_fsteps(min(abs(rvelocity), rconfig.max_velocity) * speed);
+    auto duration = max(abs(dx) / xrate, abs(dr) / rrate);
+    // Each axis has own acceleration and jerk limit
+    auto accel = 0.0f;
+    auto jerk = 0.0f;
+    if (dx != 0) {
+        accel = xconfig.units_to_fsteps(xconfig.max_accel) * major / abs(dx);
+        jerk = xconfig.units_to_fsteps(xconfig.max_jerk) * major / abs(dx);
+    }
+    if (dr != 0) {
+        auto rmax_accel = raccel_limit > 0 ? min(raccel_limit, rconfig.max_accel) : rconfig.max_accel;
+        auto raccel = rconfig.units_to_fsteps(rmax_accel) * major / abs(dr);
+        auto rjerk = rconfig.units_to_fsteps(rconfig.max_jerk) * major / abs(dr);
+        accel = dx != 0 ? min(accel, raccel) : raccel;
+        jerk = dx != 0 ? min(jerk, rjerk) : rjerk;
+    }
+    planner.add(dx, dr, major / duration, accel, jerk, token, gear);
+    xplanned += dx;
+    rplanned += dr;
+    return true;
 }
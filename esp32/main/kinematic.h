@@ -4,11 +4,32 @@
 #include <cstdint>
 #include <string>
 
+#include "motion_planner.h"
+#include "ring_buffer.h"
+#include "step_dda.h"
+#include "step_gear.h"
 #include "step_motor.h"
 #include "step_motor_config.h"
 #include "typeslib.h"
 #include "mathlib.h"
 
+/** The command buffer size, must be power of two */
+#define KINEMATIC_COMMANDS_SIZE 32
+/** The scheduled pitch changes, must be power of two */
+#define KINEMATIC_GEAR_CHANGES_SIZE 16
+
+/** The sequential number of the move */
+typedef uint32_t move_token_t;
+
+/** The move waiting in the command buffer */
+struct MoveCommand {
+        unit_t x;
+        unit_t r;
+        percents_t rpm;
+        move_token_t token;
+        bool geared;            // X follows R by the pitch schedule
+};
+
 class Kinematic {
         public:
                 Kinematic();
@@ -16,12 +37,25 @@ class Kinematic {
                 void update(float time);
                 void init_menu(std::string path);
 
-                void move_to(unit_t x, unit_t r, percents_t rpm);
+                move_token_t move_to(unit_t x, unit_t r, percents_t rpm);
+                move_token_t spin_to(unit_t r, percents_t rpm);
+                bool add_gear_change(unit_t r, unit_t pitch);
+                static bool pitch_to_ratio(unit_t pitch, GearRatio& ratio);
+                void dump_timing();
+                bool is_complete(move_token_t token);
+                void wait(move_token_t token);
                 void get_default_velocity(unit_t& x, unit_t& r);
                 void get_velocity(unit_t& x, unit_t& r);
                 void set_velocity(unit_t dx, unit_t dr);
+                void set_accel_limit(unit_t r);
                 void get_position(unit_t& x, unit_t& r);
                 void set_origin();
+                bool is_moving();
+                void synchronize();
+                void stop();
+                int queue_size();
+                bool home();
+                bool is_homing();
 
                 inline float get_speed() { return target_speed; }
                 inline void set_speed(float tgtv) { target_speed = tgtv; }
@@ -34,13 +68,36 @@ class Kinematic {
                 StepMotor rmotor;
                 StepMotorConfig xconfig;
                 StepMotorConfig rconfig;
+                StepDda dda;
+                MotionPlanner planner;
                 unit_t xvelocity;
                 unit_t rvelocity;
+                /** The spindle acceleration of the job (turns/s^2), 0 for the motor one */
+                unit_t raccel_limit;
                 float rvelocity_k;
                 int log;
                 static Kinematic instance;
 
         private:
+                void plan_commands();
+                bool plan_move(const MoveCommand& cmd);
+                bool plan_block(steps_t dx, steps_t dr, move_token_t token, GearRatio gear);
+                void execute_blocks();
+
+                /** The moves from the winding task */
+                RingBuffer<MoveCommand, KINEMATIC_COMMANDS_SIZE> commands;
+                move_token_t last_token;
+                /** The geared move splits to the blocks, it is planned in parts */
+                MoveCommand current;
+                bool current_pending;
+                /** The pitch schedule from the winding task */
+                RingBuffer<GearChange, KINEMATIC_GEAR_CHANGES_SIZE> gear_changes;
+                GearRatio gear_ratio;
+                /** The gear of the DDA at the end of the planned blocks */
+                StepGear gear_planned;
+                /** The position at the end of the last planned move */
+                steps_t xplanned;
+                steps_t rplanned;
                 float curent_speed;
                 float target_speed;
                 float speed_acc;
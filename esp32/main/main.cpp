@@ -21,10 +21,13 @@
 #include "menu.h"
 #include "config.h"
 #include "kinematic.h"
+#include "motion_trace.h"
 #include "step_motor.h"
 #include "menu_export.h"
 #include "mathlib.h"
 #include "orthocyclic_round.h"
+#include "helical_round.h"
+#include "orthocyclic_rect.h"
 
 #ifdef CONFIG_IDF_TARGET_ESP32
 #define CHIP_NAME "ESP32"
@@ -42,6 +45,8 @@ float g_speed = 1;
 #define GPIO_R GPIO_NUM_2
 
 OrthocyclicRound ortho_round;
+HelicalRound helical_round;
+OrthocyclicRect ortho_rect;
 
 static void init_menu() {
     // Create root menu
@@ -57,6 +62,8 @@ static void init_menu() {
     // Initialize children
     Kinematic::instance.init_menu(std::string("kinematic"));
     ortho_round.init_menu("ortho-round");
+    helical_round.init_menu("helical-round");
+    ortho_rect.init_menu("ortho-rect");
 }
 
 // ==============================================================================
@@ -91,6 +98,8 @@ extern "C" void app_main(void)
 
     // After menu initialized
     ortho_round.update_config();
+    helical_round.update_config();
+    ortho_rect.update_config();
 
     vTaskDelay(200 / portTICK_PERIOD_MS);
 
@@ -103,6 +112,9 @@ extern "C" void app_main(void)
         Kinematic::instance.update(time);
         MenuSystem::instance.update(time);
         ortho_round.update();
+        helical_round.update();
+        ortho_rect.update();
+        MotionTrace::instance.update();
     }
     printf("Restarting now.\n");
     fflush(stdout);
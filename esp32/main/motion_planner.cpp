@@ -0,0 +1,117 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "motion_planner.h"
+
+/** ******************************************/
+/** The look-ahead planner                   */
+/** ******************************************/
+
+MotionPlanner::MotionPlanner() {
+    for (auto i = 0; i < DDA_AXES; i++)
+        junction_rate[i] = 0;
+}
+
+void MotionPlanner::clear() {
+    blocks.clear();
+}
+
+/**
+ * Add the move to the buffer and replan. The rate and the
+ * acceleration are for the major axis (steps/s). The token
+ * comes back from the executor when the block is complete.
+ * In the geared block `dx` must be the steps X makes by the gear.
+ * Return false when the buffer is full.
+ */
+bool MotionPlanner::add(steps_t dx, steps_t dr, float rate, float accel,
+                        float jerk, uint32_t token, GearRatio gear) {
+    if (is_full())
+        return false;
+
+    MotionBlock block;
+    block.dda.delta[0] = dx;
+    block.dda.delta[1] = dr;
+    block.dda.major = 0;
+    block.dda.token = token;
+    block.dda.gear = gear;
+    for (auto i = 0; i < DDA_AXES; i++) {
+        auto n = abs(block.dda.delta[i]);
+        if (n > block.dda.major)
+            block.dda.major = n;
+    }
+    if (block.dda.major == 0)
+        return true;
+    block.nominal_rate = rate;
+    block.accel = accel;
+    block.jerk = jerk;
+    // The first block starts from the rest, the previous one is
+    // already executing and its exit velocity is zero
+    block.max_entry = is_empty() ? 0 : junction_factor(blocks.back(), block);
+    block.entry = block.max_entry;
+    blocks.push(block);
+    recalculate();
+    return true;
+}
+
+/** The oldest block and its rates, the block stays in the buffer */
+bool MotionPlanner::peek(MotionBlock& block, float& entry_rate, float& exit_rate) {
+    if (is_empty())
+        return false;
+    block = blocks.front();
+    auto exit = size() > 1 ? blocks.at(1).entry : 0;
+    entry_rate = block.entry * block.nominal_rate;
+    exit_rate = exit * block.nominal_rate;
+    return true;
+}
+
+/**
+ * Take the oldest block for execution. Its entry rate is fixed
+ * by now, so it becomes the fixed entry of the next one.
+ */
+bool MotionPlanner::pop(MotionBlock& block, float& entry_rate, float& exit_rate) {
+    if (!peek(block, entry_rate, exit_rate))
+        return false;
+    blocks.pop(block);
+    if (!is_empty())
+        blocks.front().max_entry = blocks.front().entry;
+    return true;
+}
+
+/**
+ * The maximum junction velocity as the factor of the nominal
+ * rates. Both blocks run at the same fraction of own nominal
+ * rate at the junction.
+ */
+float MotionPlanner::junction_factor(const MotionBlock& a, const MotionBlock& b) {
+    auto factor = 1.0f;
+    for (auto i = 0; i < DDA_AXES; i++) {
+        auto va = a.nominal_rate * a.dda.delta[i] / a.dda.major;
+        auto vb = b.nominal_rate * b.dda.delta[i] / b.dda.major;
+        auto jump = fabsf(va - vb);
+        if (jump > junction_rate[i])
+            factor = fminf(factor, junction_rate[i] / jump);
+    }
+    return factor;
+}
+
+/** The backward and then the forward pass over the buffer */
+void MotionPlanner::recalculate() {
+    auto n = size();
+    // Backward: each block should be able to stop at the end
+    auto next_entry = 0.0f;
+    for (auto k = n - 1; k > 0; k--) {
+        auto& b = blocks.at(k);
+        auto exit_rate = next_entry * b.nominal_rate;
+        auto max_rate = sqrtf(exit_rate * exit_rate + 2 * b.accel * b.dda.major);
+        b.entry = fminf(b.max_entry, max_rate / b.nominal_rate);
+        next_entry = b.entry;
+    }
+    // Forward: each block should be able to reach the exit rate
+    for (auto k = 0; k < n - 1; k++) {
+        auto& b = blocks.at(k);
+        auto& next = blocks.at(k + 1);
+        auto entry_rate = b.entry * b.nominal_rate;
+        auto max_rate = sqrtf(entry_rate * entry_rate + 2 * b.accel * b.dda.major);
+        next.entry = fminf(next.entry, max_rate / b.nominal_rate);
+    }
+}
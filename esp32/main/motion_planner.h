@@ -0,0 +1,60 @@
+#ifndef MOTION_PLANNER_H_
+#define MOTION_PLANNER_H_
+
+#include "ring_buffer.h"
+#include "step_dda.h"
+#include "typeslib.h"
+
+/** The look-ahead buffer size, must be power of two */
+#define MOTION_PLANNER_SIZE 16
+/** The blocks given to the executor ahead of the current one */
+#define MOTION_BLOCKS_AHEAD 3
+
+/**
+ * The move waiting in the look-ahead buffer. All rates are
+ * for the major axis. The entry rate is the factor of the
+ * nominal rate, because the major axes of the neighbour
+ * blocks can be different.
+ */
+struct MotionBlock {
+    DdaBlock dda;
+    float nominal_rate;     // steps/s
+    float accel;            // steps/s^2
+    float jerk;             // steps/s^3
+    float max_entry;        // the junction limit, factor of nominal
+    float entry;            // planned entry, factor of nominal
+};
+
+/**
+ * The look-ahead planner. It buffers the moves and computes
+ * the junction velocities, so the motion does not stop between
+ * the moves. At the junction the velocity of each axis changes
+ * at most by its `junction_rate`. The last move in the buffer
+ * always ends with zero velocity.
+ */
+class MotionPlanner {
+    public:
+        MotionPlanner();
+
+        void clear();
+        bool add(steps_t dx, steps_t dr, float rate, float accel,
+                 float jerk = 0, uint32_t token = 0,
+                 GearRatio gear = GearRatio{0, 0});
+        bool peek(MotionBlock& block, float& entry_rate, float& exit_rate);
+        bool pop(MotionBlock& block, float& entry_rate, float& exit_rate);
+
+        inline int size() const { return blocks.size(); }
+        inline bool is_empty() const { return blocks.is_empty(); }
+        inline bool is_full() const { return blocks.is_full(); }
+
+        /** The maximum velocity jump of the axis (steps/s) */
+        float junction_rate[DDA_AXES];
+
+    private:
+        float junction_factor(const MotionBlock& a, const MotionBlock& b);
+        void recalculate();
+
+        RingBuffer<MotionBlock, MOTION_PLANNER_SIZE> blocks;
+};
+
+#endif // MOTION_PLANNER_H_
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_attr.h"
+
+#include "motion_trace.h"
+
+/** ******************************************/
+/** The motion trace                         */
+/** ******************************************/
+
+MotionTrace MotionTrace::instance;
+
+MotionTrace::MotionTrace()
+    : enabled(false)
+    , dropped(0)
+    , lock(portMUX_INITIALIZER_UNLOCKED)
+    , dropped_sent(0)
+{}
+
+/** Push the record, the producers are the ISRs and the tasks */
+void IRAM_ATTR MotionTrace::add(TraceAxis axis, TraceEvent event, int32_t position,
+                                int32_t value, uint16_t arg) {
+    TraceRecord rec;
+    rec.time_us = (uint32_t)esp_timer_get_time();
+    rec.axis = (uint8_t)axis;
+    rec.event = (uint8_t)event;
+    rec.arg = arg;
+    rec.position = position;
+    rec.value = value;
+    portENTER_CRITICAL_SAFE(&lock);
+    if (!ring.push(rec))
+        dropped++;
+    portEXIT_CRITICAL_SAFE(&lock);
+}
+
+/** Drop the records (the consumer side) */
+void MotionTrace::clear() {
+    ring.clear();
+}
+
+/**
+ * Write the records by the frames, return the frames written. The
+ * frame carries the records dropped since the previous one.
+ */
+int MotionTrace::drain(trace_write_t write, void* ctx, int max_frames) {
+    uint8_t frame[MOTION_TRACE_HEADER_SIZE + MOTION_TRACE_FRAME_RECORDS * sizeof(TraceRecord) + 2];
+    auto frames = 0;
+    while (frames < max_frames && !ring.is_empty()) {
+        auto count = 0;
+        auto data = frame + MOTION_TRACE_HEADER_SIZE;
+        TraceRecord rec;
+        while (count < MOTION_TRACE_FRAME_RECORDS && ring.pop(rec)) {
+            memcpy(data + count * sizeof(TraceRecord), &rec, sizeof(TraceRecord));
+            count++;
+        }
+        auto lost = dropped - dropped_sent;
+        lost = lost > 0xFFFF ? 0xFFFF : lost;
+        dropped_sent += lost;
+        frame[0] = MOTION_TRACE_MAGIC0;
+        frame[1] = MOTION_TRACE_MAGIC1;
+        frame[2] = MOTION_TRACE_VERSION;
+        frame[3] = (uint8_t)count;
+        frame[4] = (uint8_t)(lost & 0xFF);
+        frame[5] = (uint8_t)(lost >> 8);
+        auto size = MOTION_TRACE_HEADER_SIZE + count * sizeof(TraceRecord);
+        auto crc = crc16(frame, size);
+        frame[size] = (uint8_t)(crc & 0xFF);
+        frame[size + 1] = (uint8_t)(crc >> 8);
+        write(frame, size + 2, ctx);
+        frames++;
+    }
+    return frames;
+}
+
+static void write_stdout(const uint8_t* data, size_t size, void* ctx) {
+    fwrite(data, 1, size, stdout);
+}
+
+/**
+ * Drain the ring to the console (called by the main loop). The
+ * console must not convert the line endings (NEWLIB_STDOUT_LINE_ENDING_LF).
+ */
+void MotionTrace::update() {
+    if (drain(&write_stdout, nullptr, MOTION_TRACE_UPDATE_FRAMES) > 0)
+        fflush(stdout);
+}
+
+/** CRC-16/CCITT-FALSE */
+uint16_t MotionTrace::crc16(const uint8_t* data, size_t size, uint16_t crc) {
+    for (size_t i = 0; i < size; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (auto bit = 0; bit < 8; bit++)
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+    return crc;
+}
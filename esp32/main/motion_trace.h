@@ -0,0 +1,99 @@
+#ifndef MOTION_TRACE_H_
+#define MOTION_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+#include "ring_buffer.h"
+
+/** The records in the ring, must be power of two */
+#define MOTION_TRACE_SIZE 1024
+/** The records in one frame */
+#define MOTION_TRACE_FRAME_RECORDS 32
+/** The frames drained by one update */
+#define MOTION_TRACE_UPDATE_FRAMES 8
+/** The frame header: magic, version, count, dropped */
+#define MOTION_TRACE_MAGIC0 'M'
+#define MOTION_TRACE_MAGIC1 'T'
+#define MOTION_TRACE_VERSION 1
+#define MOTION_TRACE_HEADER_SIZE 6
+
+/** The source of the record */
+enum class TraceAxis : uint8_t { X, R, Dda, Kinematic };
+
+/**
+ * What happened. The event tells the meaning of the fields:
+ *
+ *   Segment  position, value = signed interval (fixed point us), arg = steps
+ *   Move     position, value = target, arg = tag
+ *   Done     position
+ *   Halt     position
+ *   Endstop  position, value = latched position
+ *   Trigger  position
+ *   Homing   position, value = error, arg = state
+ *   Block    position = dX, value = dR, arg = token
+ *   Command  position = X steps, value = R steps, arg = token
+ *   Stop     -
+ */
+enum class TraceEvent : uint8_t {
+    Segment, Move, Done, Halt, Endstop, Trigger, Homing, Block, Command, Stop
+};
+
+/** The compact record, the frame carries it as is (little endian) */
+struct TraceRecord {
+    uint32_t time_us;
+    uint8_t axis;
+    uint8_t event;
+    uint16_t arg;
+    int32_t position;
+    int32_t value;
+};
+
+static_assert(sizeof(TraceRecord) == 16, "The record is 16 bytes");
+
+/** The sink of the frames */
+typedef void (*trace_write_t)(const uint8_t* data, size_t size, void* ctx);
+
+/**
+ * The recorder of the motion events. The ISRs and the tasks add
+ * the records without any formatting, the spinlock serializes
+ * them. The main loop drains the ring by the frames:
+ *
+ *     'M' 'T' version count dropped[2] records[count] crc[2]
+ *
+ * The CRC-16 (CCITT) covers the header and the records, so the
+ * decoder finds the frames between the log lines of the console.
+ * When the ring is full the new records are dropped and counted.
+ */
+class MotionTrace {
+    public:
+        MotionTrace();
+
+        /** Add the record if the trace is enabled (ISR safe) */
+        IRAM_ATTR inline void record(TraceAxis axis, TraceEvent event, int32_t position,
+                                     int32_t value = 0, uint16_t arg = 0) {
+            if (enabled)
+                add(axis, event, position, value, arg);
+        }
+        void add(TraceAxis axis, TraceEvent event, int32_t position, int32_t value, uint16_t arg);
+        int drain(trace_write_t write, void* ctx, int max_frames);
+        void update();
+        void clear();
+
+        static uint16_t crc16(const uint8_t* data, size_t size, uint16_t crc = 0xFFFF);
+
+        volatile bool enabled;
+        uint32_t dropped;
+        static MotionTrace instance;
+
+    private:
+        RingBuffer<TraceRecord, MOTION_TRACE_SIZE> ring;
+        portMUX_TYPE lock;
+        uint32_t dropped_sent;
+};
+
+#endif // MOTION_TRACE_H_
@@ -0,0 +1,325 @@
+#include <cstdio>
+#include <math.h>
+
+#include "coil.h"
+#include "config.h"
+#include "display.h"
+#include "input_controller.h"
+#include "kinematic.h"
+#include "mathlib.h"
+#include "menu_event.h"
+#include "menu_export.h"
+#include "menu_item.h"
+#include "menu_system.h"
+#include "orthocyclic_rect.h"
+
+static const char TAG[] = "orthocyclic-rect";
+
+/** The height of the orthocyclic layer over the layer below */
+#define ORTHOCYCLIC_LAYER_H 0.866f
+
+/** The constructor */
+OrthocyclicRect::OrthocyclicRect()
+    : RectCoil()
+    , wire_velocity(RECT_WIRE_VELOCITY)
+    , modulate(true)
+    , layers(0)
+    , layer_turns(0)
+    , total_turns(0)
+    , winding_len(0)
+    , winding_h(0)
+    , coil_a(0)
+    , coil_b(0)
+    , wire_len(0)
+    , winding_task_handle(NULL)
+    , run(false)
+{
+    wire_od = 0.45;
+    size_a = 20;
+    size_b = 10;
+    corner_r = 1;
+    bob_len = 24.9;
+    for (auto i = 0; i < RECT_VELOCITY_LUT_SIZE; i++)
+        velocity_lut[i] = 0;
+}
+
+/** Update with fixed frequency */
+void OrthocyclicRect::update()
+{
+    if (version != menu->get_version())
+        update_config();
+
+    if (is_winding()) {
+        if (MenuSystem::instance.is_visible) {
+            if (input_get_key_up(Button::A) || input_get_key_up(Button::B))
+                MenuSystem::instance.set_visible(false);
+            run = false;
+        } else {
+            // The layer goes while the button A is held
+            run = input_get_key(Button::A);
+        }
+    }
+}
+
+void OrthocyclicRect::init_menu(std::string path)
+{
+    RectCoil::init_menu(path);
+
+    // Editable settings
+    menu = MenuSystem::instance.get_or_create(path);
+    menu->add(new FloatItem(menu, "wire-v",
+                            [&] () -> float { return wire_velocity; },
+                            [&] (float v) { wire_velocity = v < 1 ? 1 : v; }));
+    menu->get_last<FloatItem>().set_step(10).set_precision(0);
+    menu->add(new BoolItem(menu, "modulate", [&] () -> bool { return modulate; },
+                           [&](bool v) { modulate = v; }));
+    // Read only settings
+    menu->add(new IntItem(menu, "-layers", [&] () -> int { return layers; }, nullptr));
+    menu->add(new IntItem(menu, "-turns", [&] () -> int { return total_turns; }, nullptr));
+    menu->add(new FloatItem(menu, "-coil-a", [&] () -> float { return coil_a; }, nullptr));
+    menu->add(new FloatItem(menu, "-coil-b", [&] () -> float { return coil_b; }, nullptr));
+    menu->add(new FloatItem(menu, "-wind-h", [&] () -> float { return winding_h; }, nullptr));
+    // Actions
+    menu->add(new ActionItem(menu, "start", [&] (MenuItem* it, MenuEvent e) { start(); }));
+    menu->add(new ActionItem(menu, "stop", [&] (MenuItem* it, MenuEvent e) { stop(); }));
+}
+
+static void display_status(int turn, int turns, int layer, int layers, float rpm)
+{
+    MenuSystem::instance.set_visible(false);
+    display_clear();
+    // The values are clamped, so the line fits the display
+    char buf[DISPLAY_COLUMNS + 1];
+    std::snprintf(buf, sizeof(buf), "T: %d/%d", CLAMP(turn, 0, 99999), CLAMP(turns, 0, 99999));
+    display_print(0,0, buf);
+    std::snprintf(buf, sizeof(buf), "L: %d/%d F%d", CLAMP(layer, 0, 999),
+                  CLAMP(layers, 0, 999), (int)CLAMP(rpm, 0.0f, 999.0f));
+    display_print(0,1, buf);
+    display_update();
+}
+
+/** The radius of the wire center at the corner of the layer */
+float OrthocyclicRect::get_layer_radius(int layer)
+{
+    return corner_r + wire_od / 2 + (layer - 1) * wire_od * ORTHOCYCLIC_LAYER_H;
+}
+
+/** The odd layers fill the bobbin, the even ones lay in the grooves */
+int OrthocyclicRect::get_layer_turns(int layer)
+{
+    return (layer & 1) ? layer_turns : layer_turns - 1;
+}
+
+/**
+ * The wire taken by the spindle per radian at the angle: the
+ * distance from the axis to the wire, when the wire guide is far
+ * from the bobbin. The straight parts of the sides do not depend
+ * on the layer, the corners grow by the radius.
+ */
+float OrthocyclicRect::get_take_up(float angle, float radius)
+{
+    auto a = fmaxf(size_a / 2 - corner_r, 0);
+    auto b = fmaxf(size_b / 2 - corner_r, 0);
+    return a * fabsf(cosf(angle)) + b * fabsf(sinf(angle)) + radius;
+}
+
+/**
+ * Build the spindle velocity (turns/s) of the layer. Each entry is
+ * limited by the fastest take up inside its segment, then the
+ * entries are limited by the acceleration of the spindle, so the
+ * next entry is reachable in the one segment. The turns repeat,
+ * so the table is passed twice around in both directions.
+ */
+void OrthocyclicRect::build_velocity_lut(int layer, float max_velocity)
+{
+    auto n = RECT_VELOCITY_LUT_SIZE;
+    auto radius = get_layer_radius(layer);
+    auto segment = 2 * (float)M_PI / n;
+    // The take up is maximal at the diagonals of the straight parts
+    auto diagonal = atan2f(fmaxf(size_b / 2 - corner_r, 0), fmaxf(size_a / 2 - corner_r, 0));
+    float peaks[4] = { diagonal, (float)M_PI - diagonal,
+                       (float)M_PI + diagonal, 2 * (float)M_PI - diagonal };
+    auto slowest = max_velocity;
+    for (auto k = 0; k < n; k++) {
+        auto from = k * segment;
+        auto to = from + segment;
+        auto take_up = fmaxf(get_take_up(from, radius), get_take_up(to, radius));
+        for (auto peak : peaks) {
+            if (peak > from && peak < to)
+                take_up = fmaxf(take_up, get_take_up(peak, radius));
+        }
+        auto v = wire_velocity / (2 * (float)M_PI * take_up);
+        velocity_lut[k] = fminf(v, max_velocity);
+        slowest = fminf(slowest, velocity_lut[k]);
+    }
+    if (!modulate) {
+        for (auto k = 0; k < n; k++)
+            velocity_lut[k] = slowest;
+        return;
+    }
+    auto dv2 = 2 * Kinematic::instance.rconfig.max_accel / n;
+    for (auto i = 1; i < 2 * n; i++) {
+        auto k = i % n;
+        auto prev = (i - 1) % n;
+        velocity_lut[k] = fminf(velocity_lut[k], sqrtf(velocity_lut[prev] * velocity_lut[prev] + dv2));
+    }
+    for (auto i = 2 * n - 2; i >= 0; i--) {
+        auto k = i % n;
+        auto next = (i + 1) % n;
+        velocity_lut[k] = fminf(velocity_lut[k], sqrtf(velocity_lut[next] * velocity_lut[next] + dv2));
+    }
+}
+
+/**
+ * Wind the layers turn by turn. Each turn is the moves of the
+ * table segments, the first RECT_CROSS_ENTRIES of them shift X
+ * to the next turn. The planner joins the moves, so the spindle
+ * slows down only where the table tells.
+ */
+void OrthocyclicRect::process()
+{
+    MenuSystem::instance.set_visible(false);
+
+    // Make current position as (0,0)
+    auto& kinematic = Kinematic::instance;
+    kinematic.set_origin();
+    kinematic.set_velocity(wire_od, 1);
+    auto max_velocity = fminf(fabsf(kinematic.rvelocity), kinematic.rconfig.max_velocity);
+
+    auto n = RECT_VELOCITY_LUT_SIZE;
+    auto posx = 0.0f;
+    auto turn = 0;
+    for (auto layer = 1; layer <= layers && turn < total_turns; layer++) {
+        build_velocity_lut(layer, max_velocity);
+        // The even layer starts in the groove of the last turn
+        auto dir = (layer & 1) ? 1 : -1;
+        auto start = (layer & 1) ? 0 : (layer_turns - 1.5f) * wire_od;
+        auto turns = get_layer_turns(layer);
+        ESP_LOGI(TAG, "Layer %d from x: %f turn: %d", layer, start, turn);
+        for (auto t = 0; t < turns && turn < total_turns; t++) {
+            // Plan ahead only two turns, so the winding does
+            // not run away when the operator releases button
+            while (kinematic.queue_size() > n)
+                vTaskDelay(1/portTICK_PERIOD_MS);
+            while (!run)
+                vTaskDelay(1/portTICK_PERIOD_MS);
+
+            auto target = start + dir * t * wire_od;
+            display_status(turn + 1, total_turns, layer, layers, 100 * velocity_lut[0] / max_velocity);
+            for (auto k = 0; k < n; k++) {
+                auto x = target;
+                if (k < RECT_CROSS_ENTRIES)
+                    x = posx + (target - posx) * (k + 1) / RECT_CROSS_ENTRIES;
+                auto r = turn + (k + 1.0f) / n;
+                kinematic.move_to(x, r, 100 * velocity_lut[k] / max_velocity);
+            }
+            posx = target;
+            turn++;
+        }
+    }
+    kinematic.synchronize();
+    printf("\nCOMPLETE %d LAYERS AND %d TURNS\n", layers, turn);
+    winding_task_handle = NULL;
+    vTaskDelete(NULL);
+}
+
+#define WINDING_TASK_PRIO 2
+
+static void c_rect_task(void* arg)
+{
+    ((OrthocyclicRect*)arg)->process();
+}
+
+/** Start winding process */
+void OrthocyclicRect::start()
+{
+    if (is_winding()) {
+        ESP_LOGW(TAG,"The coild is already winding");
+    } else {
+        ESP_LOGI(TAG, "Start winding task");
+        inspect();
+        xTaskCreate(c_rect_task, "rect_task", 4096, this, WINDING_TASK_PRIO, &winding_task_handle);
+    }
+}
+
+void OrthocyclicRect::stop() {
+    if (is_winding()) {
+        ESP_LOGI(TAG,"Stop winding");
+        vTaskDelete(winding_task_handle);
+        winding_task_handle = NULL;
+        Kinematic::instance.stop();
+    }
+}
+
+void OrthocyclicRect::update_config() {
+    version = menu->get_version();
+    layer_turns = (int)floorf(bob_len / wire_od);
+    layer_turns = layer_turns < 2 ? 2 : layer_turns;
+    winding_len = layer_turns * wire_od;
+
+    if (wire_layers > 0) {
+        // Make coil based on target layers
+        layers = wire_layers;
+        total_turns = 0;
+        for (auto layer = 1; layer <= layers; layer++)
+            total_turns += get_layer_turns(layer);
+    } else if (wire_turns > 0) {
+        // Make coil based on the total amout of turns
+        total_turns = wire_turns;
+        layers = 0;
+        for (auto turns = 0; turns < total_turns; )
+            turns += get_layer_turns(++layers);
+    } else {
+        layers = 1;
+        total_turns = layer_turns;
+    }
+    winding_h = wire_od + (layers - 1) * wire_od * ORTHOCYCLIC_LAYER_H;
+    coil_a = size_a + 2 * winding_h;
+    coil_b = size_b + 2 * winding_h;
+    // The wire length by the path of the wire center
+    auto a = fmaxf(size_a / 2 - corner_r, 0);
+    auto b = fmaxf(size_b / 2 - corner_r, 0);
+    wire_len = 0;
+    auto left = total_turns;
+    for (auto layer = 1; layer <= layers; layer++) {
+        auto turns = get_layer_turns(layer) < left ? get_layer_turns(layer) : left;
+        wire_len += turns * (4 * (a + b) + 2 * (float)M_PI * get_layer_radius(layer));
+        left -= turns;
+    }
+    // Display result
+    inspect();
+}
+
+/**
+ * Print all settings to the  terminal
+ **/
+void OrthocyclicRect::inspect()
+{
+    RectCoil::inspect();
+    printf("Orthocyclic rect:\n");
+    // Print the arguments
+    printf("  Wire velocity   = %.1f mm/s\n", wire_velocity);
+    printf("  Modulate        = %d\n", modulate);
+    // Computed parameters
+    printf("Computed:\n");
+    printf("  Total Turns     = %d\n", total_turns);
+    printf("  Layers num      = %d\n", layers);
+    printf("  Layer turns     = %d\n", layer_turns);
+    printf("  Winding len     = %.2f mm\n", winding_len);
+    printf("  Winding H       = %.2f mm\n", winding_h);
+    printf("  Coil A x B      = %.2f x %.2f mm\n", coil_a, coil_b);
+    printf("  Wire length     = %.2f m\n", wire_len / 1000);
+    // The winding task owns the table
+    if (is_winding())
+        return;
+    // The spindle of the first layer by the motor limit, the turn
+    // rate is the harmonic mean of the segments
+    build_velocity_lut(1, Kinematic::instance.rconfig.max_velocity);
+    auto slowest = velocity_lut[0];
+    auto time = 0.0f;
+    for (auto k = 0; k < RECT_VELOCITY_LUT_SIZE; k++) {
+        slowest = fminf(slowest, velocity_lut[k]);
+        time += 1.0f / (velocity_lut[k] * RECT_VELOCITY_LUT_SIZE);
+    }
+    printf("  Turn rate       = %.2f turns/s (the corner %.2f)\n", 1 / time, slowest);
+}
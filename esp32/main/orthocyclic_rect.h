@@ -0,0 +1,69 @@
+#ifndef ORTHOCYCLIC_RECT_H_
+#define ORTHOCYCLIC_RECT_H_
+
+#include <string>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "coil.h"
+#include "config.h"
+
+/** *******************************************************************/
+/** (((((((((((((((((((((((( ORTHOCYCLIC RECT )))))))))))))))))))))))) */
+/** *******************************************************************/
+
+/**
+ * Orthocyclic rectangular coil. The wire takes up faster at the
+ * corners than at the middle of the sides, so the spindle velocity
+ * goes by the table of the turn angle: each entry is the segment of
+ * the turn and its allowed velocity by the wire velocity limit and
+ * the acceleration of the spindle. The table is built per layer,
+ * because the corner radius grows with the winding.
+ */
+class OrthocyclicRect : public RectCoil
+{
+    public:
+
+        OrthocyclicRect();
+
+        void init_menu(std::string path);
+        void start();
+        void stop();
+        void update();
+        void update_config();
+        void inspect();
+        void process();
+
+        inline bool is_winding() { return winding_task_handle != NULL; }
+
+        // The wire velocity limit (mm/s)
+        float wire_velocity;
+        // Modulate the spindle velocity in the turn, else the whole
+        // turn goes by the slowest entry
+        bool modulate;
+
+        int layers;
+        int layer_turns;
+        int total_turns;
+        float winding_len;
+        float winding_h;
+        float coil_a;
+        float coil_b;
+        float wire_len;
+        // The spindle velocity of the turn segments (turns/s)
+        float velocity_lut[RECT_VELOCITY_LUT_SIZE];
+
+    private:
+
+        float get_take_up(float angle, float radius);
+        void build_velocity_lut(int layer, float max_velocity);
+        float get_layer_radius(int layer);
+        int get_layer_turns(int layer);
+
+        /** Thread */
+        TaskHandle_t winding_task_handle;
+        volatile bool run;
+};
+
+#endif // ORTHOCYCLIC_RECT_H_
@@ -23,14 +23,17 @@ OrthocyclicRound::OrthocyclicRound()
     , style(Style::Equal)
     , fill_last(true)
     , manual_direct(true)
+    , continuous(false)
     , num_csections(12)
     , stop_before(STOP_BEFORE_TURNS)
+    , wire_accel(WIRE_TENSION_ACCEL)
     , turns_odd(0)
     , turns_even(0)
     , turns_last(0)
     , total_turns(0)
+    , cross_arc(0)
+    , continuous_arc(0)
     , feed_rate(50)
-    , feed_rate_norm(0)
 {
     /*
      * The coil for the plastic bobin the AR prototype 4
@@ -93,9 +96,6 @@ void OrthocyclicRound::update()
                 }
 
             }
-            // go to minimum speed
-            if (one_turn_dir == 0 && !change_layer)
-                reset_feed_rate_norm();
         }
     } else {
         if (!MenuSystem::instance.is_edit) {
@@ -148,9 +148,15 @@ void OrthocyclicRound::init_menu(std::string path)
                              [&] (StringItem* item, MenuEvent evt) { on_update_style(item, evt); }));
     menu->add(new BoolItem(menu, "fill-last", [&] () -> bool { return fill_last; },
                            [&](bool v) { fill_last = v; }));
+    menu->add(new BoolItem(menu, "continuous", [&] () -> bool { return continuous; },
+                           [&](bool v) { continuous = v; }));
+    menu->add(new FloatItem(menu, "wire-acc",
+                            [&] () -> float { return wire_accel; },
+                            [&] (float v) { wire_accel = v < 1 ? 1 : v; }));
+    menu->get_last<FloatItem>().set_step(100).set_precision(0);
     menu->add(new IntItem(menu, "num-csect",
                           [&] () -> int { return num_csections; },
-                          [&] (int v) { num_csections = v; }));
+                          [&] (int v) { num_csections = v < 1 ? 1 : v; }));
     // Read only settings
     menu->add(new IntItem(menu, "-turns-odd", [&] () -> int { return turns_odd; }, nullptr));
     menu->add(new IntItem(menu, "-turns-even", [&] () -> int { return turns_even; }, nullptr));
@@ -160,9 +166,11 @@ void OrthocyclicRound::init_menu(std::string path)
     menu->add(new FloatItem(menu, "-coil-od-c.", [&] () -> float { return coil_od_cross; }, nullptr));
     menu->add(new FloatItem(menu, "-wind-l", [&] () -> float { return winding_len; }, nullptr));
     menu->add(new FloatItem(menu, "-wind-h", [&] () -> float { return winding_h; }, nullptr));
+    menu->add(new FloatItem(menu, "-cross-arc", [&] () -> float { return cross_arc; }, nullptr));
     // Actions
     menu->add(new ActionItem(menu, "start", [&] (MenuItem* it, MenuEvent e) { start(); }));
     menu->add(new ActionItem(menu, "stop", [&] (MenuItem* it, MenuEvent e) { stop(); }));
+    menu->add(new ActionItem(menu, "program", [&] (MenuItem* it, MenuEvent e) { dump_program(); }));
 }
 
 static const float sin60 = 0.86602540378;
@@ -173,12 +181,29 @@ static const float sin60 = 0.86602540378;
  */
 float OrthocyclicRound::crossover_size_norm() {return 1.0 / (float)num_csections; }
 
+/**
+ * The crossover arc of the continuous mode. X follows R by the gear
+ * which makes at most one X step per R step, so the arc takes as
+ * many sections as it needs to shift X by the wire. Zero when even
+ * the whole turn is too short.
+ */
+float OrthocyclicRound::get_continuous_arc() {
+    GearRatio ratio;
+    for (auto n = 1; n <= num_csections; n++) {
+        auto arc = (float)n / (float)num_csections;
+        if (Kinematic::pitch_to_ratio(wire_od / arc, ratio))
+            return arc;
+    }
+    return 0;
+}
+
 /**
  * Get the position of cross over for given layer
  * The first layer starts from the last secrtion (23)
  */
 int OrthocyclicRound::get_crossover_section_num(int layer) {
-    return (num_csections - layer) % num_csections;
+    // The layers above the sections count wrap to the last section
+    return ((num_csections - layer) % num_csections + num_csections) % num_csections;
 }
 
 /**
@@ -213,33 +238,26 @@ static void display_message(const char* msg) {
     ESP_LOGI(TAG, "MSG '%s'",msg);
 }
 
-static int feed_rate_cnt = 0;
-
-void OrthocyclicRound::reset_feed_rate_norm() {
-    feed_rate_cnt = 0;
-    feed_rate_norm = 0;
-    Kinematic::instance.set_speed(MINIMUM_SPEED_FACTOR,MINIMUM_SPEED_FACTOR);
-}
-
-void OrthocyclicRound::update_feed_rate_norm() {
-    feed_rate_cnt++;
-    if (feed_rate_cnt == INCREASE_SPEED_EACH_N_TURNS) {
-        feed_rate_cnt = 0;
-        feed_rate_norm = clamp01(feed_rate_norm + INCREASE_SPEED_STEP);
-    }
-}
-float OrthocyclicRound::get_max_feed_rate()
-{
-    return (float)feed_rate;
-}
-float OrthocyclicRound::get_min_feed_rate()
+/**
+ * The spindle acceleration (turns/s^2) the wire tension allows on
+ * the layer: the wire accelerates by the circumference of the wire
+ * center. The planner takes the lower of it and the motor limit.
+ */
+float OrthocyclicRound::get_spindle_accel(int layer)
 {
-    return (float)feed_rate * (float)MINIMUM_SPEED_FACTOR;
+    auto diameter = bob_id + wire_od * (1 + 2 * sin60 * (layer - 1));
+    return wire_accel / ((float)M_PI * diameter);
 }
 
+/**
+ * Each turn goes by the full feed. The planner ramps the spindle
+ * up from the stop and down to the flange or to the end of the
+ * queue, when the operator releases the button, by the axes and
+ * the wire tension acceleration.
+ */
 float OrthocyclicRound::get_feed_rate()
 {
-    return lerp(feed_rate_norm, get_min_feed_rate(), get_max_feed_rate());
+    return feed_rate;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -271,155 +289,391 @@ float OrthocyclicRound::get_feed_rate()
 //                                                                           //
 ///////////////////////////////////////////////////////////////////////////////
 
+/** The nominal turns of the layer */
+int OrthocyclicRound::get_layer_turns(int layer)
+{
+    if (layer == layers)
+        return turns_last;
+    return (layer & 1) ? turns_odd : turns_even;
+}
+
+/**
+ * Compile the layer to the program. The layer winds its turns from
+ * the start of the layer, each turn makes the crossover move in
+ * its section then goes to the end of the turn. The extra turns
+ * (manual direct) follow the turns of the layer, the next layer
+ * starts from the last nominal turn. Return false when the spindle
+ * has to go back inside the layer.
+ */
+bool OrthocyclicRound::compile_layer(int layer)
+{
+    program.clear(layer);
+    auto layer_flags = continuous_arc > 0 ? WIND_FLAG_CONTINUOUS : 0;
+
+    // The start of the layer by the nominal layers before
+    auto posx = 0.0f;
+    auto turn = 0;
+    for (auto before = 1; before < layer; before++) {
+        auto before_turns = get_layer_turns(before);
+        for (auto layer_turn = 1; layer_turn<=before_turns; layer_turn++)
+            posx += ((before & 1) ? wire_od : -wire_od);
+        posx += (before & 1) ? xshift_odd : xshift_even;
+        turn += before_turns;
+    }
+
+    auto odd_layer = layer & 1;
+    auto layer_turns = get_layer_turns(layer);
+    auto direction = layer & 1;
+
+    // Crossover position should change every layer
+    auto cross_section = get_crossover_section_num(layer);
+    auto cross_starts = get_crossover_norm(layer);
+    auto cross_ends = (cross_starts + crossover_size_norm());
+    if ((layer_flags & WIND_FLAG_CONTINUOUS) && num_csections > 1) {
+        // The sections spread over the turn, so the wide arc
+        // still moves each layer and ends within the turn
+        cross_starts = cross_section * (1.0f - cross_arc) / (num_csections - 1);
+        cross_ends = cross_starts + cross_arc;
+    }
+
+    program.add(WindOp::Layer, layer, posx, turn,
+                (direction ? WIND_FLAG_FORWARD : 0) | layer_flags);
+
+    // Add extra turns for the manual direction
+    auto max_turns = layer_turns + (manual_direct ? ALLOW_EXTRA_TURNS : 0);
+    // Deactivate auto-winding before end of layer
+    auto auto_stop_at = layer_turns - stop_before;
+    auto pause_at = auto_stop_at > 1 ? auto_stop_at : 1;
+
+    for (auto layer_turn = 1; layer_turn<=max_turns; layer_turn++) {
+        turn++;
+        auto oldx = posx;
+        posx += (direction ? wire_od : -wire_od);
+        uint8_t flags = layer_turn > layer_turns ? WIND_FLAG_EXTRA : 0;
+        if (layer_flags & WIND_FLAG_CONTINUOUS) {
+            // The start and the end of the arc
+            program.add(WindOp::Cross, layer, oldx, ((turn-1) + cross_starts), flags);
+            program.add(WindOp::Cross, layer, posx, ((turn-1) + cross_ends), flags);
+        } else if (cross_section == 0) {
+            // crossover at the begin of turn
+            program.add(WindOp::Cross, layer, posx, ((turn-1) + cross_ends), flags);
+        } else if (cross_section == (num_csections-1)) {
+            // crossover at the end of turn
+            program.add(WindOp::Cross, layer, oldx, ((turn-1) + cross_starts), flags);
+        } else {
+            // crossover at the middle of turn
+            program.add(WindOp::Cross, layer, oldx, ((turn-1) + cross_starts), flags);
+            program.add(WindOp::Cross, layer, posx, ((turn-1) + cross_ends), flags);
+        }
+        program.add(WindOp::Turn, layer, posx, turn, flags);
+        if (manual_direct && layer_turn == pause_at)
+            program.add(WindOp::Pause, layer);
+    }
+    program.add(WindOp::Shift, layer, odd_layer ? xshift_odd : xshift_even);
+    if (layer == layers)
+        program.add(WindOp::End, 0);
+
+    auto pc = program.find_reverse();
+    if (pc < program.size()) {
+        ESP_LOGE(TAG, "Layer %d record %d turns R back to %f", layer, (int)pc, program[pc].r);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Check the job before the start. The layers are compiled one by
+ * one, so the CRC-32 of the job continues from layer to layer and
+ * only the longest layer takes the memory. Return false when the
+ * job can not be wound: a layer turns the spindle back, the turns
+ * differ from the job or the layers do not fit the bobbin.
+ */
+bool OrthocyclicRound::compile()
+{
+    if (continuous && continuous_arc == 0)
+        ESP_LOGE(TAG, "The wire %f is too thick for the gear, wind by the moves", wire_od);
+    auto ok = layers > 0;
+    uint32_t crc = 0;
+    size_t records = 0;
+    size_t layer_records = 0;
+    auto turns = 0;
+    auto x_min = 0.0f;
+    auto x_max = 0.0f;
+    for (auto layer = 1; layer<=layers; layer++) {
+        ok = compile_layer(layer) && ok;
+        crc = program.checksum(crc);
+        records += program.size();
+        layer_records = program.size() > layer_records ? program.size() : layer_records;
+        turns += program.turns;
+        x_min = program.x_min < x_min ? program.x_min : x_min;
+        x_max = program.x_max > x_max ? program.x_max : x_max;
+    }
+    printf("Winding program:\n");
+    printf("  Records         = %d (%d bytes)\n", (int)records,
+           (int)(records * sizeof(WindRecord)));
+    printf("  Layer records   = %d (%d bytes)\n", (int)layer_records,
+           (int)(layer_records * sizeof(WindRecord)));
+    printf("  Layers          = %d\n", layers);
+    printf("  Turns           = %d\n", turns);
+    printf("  X range         = %.2f .. %.2f mm\n", x_min, x_max);
+    printf("  Checksum        = %08X\n", (unsigned)crc);
+    if (turns != total_turns) {
+        ESP_LOGE(TAG, "The layers make %d turns of %d", turns, total_turns);
+        ok = false;
+    }
+    if (x_max - x_min > bob_len) {
+        ESP_LOGE(TAG, "The layers take %f mm of the %f mm bobbin", x_max - x_min, bob_len);
+        ok = false;
+    }
+    return ok;
+}
+
+/** List the records layer by layer, the winding one when winding */
+void OrthocyclicRound::dump_program()
+{
+    if (is_winding()) {
+        program.inspect();
+        program.dump();
+        return;
+    }
+    for (auto layer = 1; layer<=layers; layer++) {
+        compile_layer(layer);
+        program.inspect();
+        program.dump();
+    }
+}
+
+/** The first record of the turn which ends before the record */
+size_t OrthocyclicRound::previous_turn(size_t pc)
+{
+    auto end = pc - 1;
+    while (program[end].op != (uint8_t)WindOp::Turn)
+        end--;
+    auto start = end;
+    while (program[start - 1].op == (uint8_t)WindOp::Cross)
+        start--;
+    return start;
+}
+
+/** The turns before the Pause record of the layer are automatic */
+size_t OrthocyclicRound::find_pause()
+{
+    auto shift_pc = program.find(WindOp::Shift, 0);
+    auto pause_pc = program.find(WindOp::Pause, 0);
+    return pause_pc < shift_pc ? pause_pc : shift_pc;
+}
+
+/**
+ * Stream the program. The records are the nominal job, the operator
+ * can change the layer early, wind the extra turns or unwind, so the
+ * moves go by the offset of the actual position from the nominal
+ * one. The offset is taken at the start of each layer.
+ */
 void OrthocyclicRound::process()
 {
     MenuSystem::instance.set_visible(false);
 
     // Make current position as (0,0)
     Kinematic::instance.set_origin();
-    Kinematic::instance.set_velocity(wire_od, crossover_size_norm());
-    reset_feed_rate_norm();
+    Kinematic::instance.set_velocity(wire_od, cross_arc);
 
     // Set the global position x and truns counter 0
     auto posx = 0.0f;
     auto turn = 0;
+    auto geared = false;
+    auto offset_x = 0.0f;
+    auto offset_r = 0.0f;
+
+    auto layer = 0;
+    auto layer_turn = 0;
+    size_t pause_pc = 0;
+    size_t pc = 0;
+    // Back at the end of the layer, the Shift waits for the operator
+    auto layer_back = false;
+    // The spindle enters the crossover of the turn in flight, the
+    // trigger sets the flag of its turn
+    volatile bool crossed[WINDING_TURNS_AHEAD];
+    for (auto& flag : crossed)
+        flag = true;
+    auto ahead = 0;
+
+    compile_layer(1);
+    while (pc < program.size()) {
+        auto& rec = program[pc];
+        switch ((WindOp)rec.op) {
+            case WindOp::Layer:
+                // At each layer activate autowinding feature
+                // and defautivate 'change direction' and
+                // 'single turn'
+                layer = rec.layer;
+                geared = (rec.flags & WIND_FLAG_CONTINUOUS) != 0;
+                layer_turn = 0;
+                pause_pc = find_pause();
+                offset_x = posx - rec.x;
+                offset_r = turn - rec.r;
+                wind_extra_turns = false;
+                change_layer = false;
+                one_turn_dir = 0;
+                Kinematic::instance.set_accel_limit(get_spindle_accel(layer));
+                ESP_LOGI(TAG, "Layer %d from x: %f turn: %d", layer, posx, turn);
+                pc++;
+                break;
 
-    // The layer's turns iterator
-    int layer_turn = 0;
+            case WindOp::Shift:
+                if (!layer_back) {
+                    ESP_LOGW(TAG, "Change the layer forward");
+                    posx += rec.x;
+                    Kinematic::instance.move_to(posx, turn, get_feed_rate());
+                    pc++;
+                    // The next layer replaces this one
+                    if (pc == program.size()) {
+                        compile_layer(layer + 1);
+                        pc = 0;
+                    }
+                    break;
+                }
+                // The operator shifts to the next layer again by the
+                // forward control or unwinds the last turn
+                // fall through
+            case WindOp::Cross:
+            case WindOp::Turn:
+                // Plan ahead only few turns, so the winding does
+                // not run away when the operator releases button.
+                // The stopped motion does not reach the trigger
+                while (!crossed[ahead % WINDING_TURNS_AHEAD] && Kinematic::instance.is_moving())
+                    vTaskDelay(1/portTICK_PERIOD_MS);
+
+                // Wait operator's control.
+                while (true) {
+                    // The operator can start the one turn
+                    // or to complete the layer
+                    if (one_turn_dir || change_layer)
+                        break;
+                    vTaskDelay(1/portTICK_PERIOD_MS);
+                }
 
-    // The layer iterator
-    for (auto layer = 1; layer<=layers; layer++) {
+                if (layer_back) {
+                    layer_back = false;
+                    if (one_turn_dir >= 0) {
+                        // The Shift record goes next
+                        one_turn_dir = 0;
+                        break;
+                    }
+                }
 
-        // At each layer activate autowinding feature
-        // and defautivate 'change direction' and
-        // 'single turn'
-        wind_extra_turns = false;
-        change_layer = false;
-        one_turn_dir = 0;
-
-        // Compute the layer's turns and direction
-        auto odd_layer = layer & 1;
-        auto last_layer = layer == layers;
-        auto layer_turns = last_layer ? turns_last : (odd_layer ? turns_odd : turns_even);
-        auto direction = layer & 1;
-
-        // Crossover position should change every layer
-        auto cross_section = get_crossover_section_num(layer);
-        auto cross_starts = get_crossover_norm(layer);
-        auto cross_ends = (cross_starts + crossover_size_norm());
-        ESP_LOGI(TAG, "Crossover section %d range [%f .. %f]", cross_section, cross_starts, cross_ends);
-
-
-        // Add extra turns for the manual direction
-        auto max_turns = layer_turns + (manual_direct ? ALLOW_EXTRA_TURNS : 0);
-        // Deactivate auto-winding before end of layer
-        auto auto_stop_at = layer_turns - stop_before;
-
-        do {
-
-            // Wait operator's control.
-            while (true) {
-                // The operator can start the one turn
-                // or to complete the layer
-                if (one_turn_dir || change_layer)
+                if (change_layer) {
+                    pc = program.find(WindOp::Shift, pc);
                     break;
-                vTaskDelay(1/portTICK_PERIOD_MS);
-            }
+                }
 
-            if (!change_layer) {
-                // There is no request to change the layer
-                // make single turen forward or backaward
                 if (one_turn_dir > 0) {
                     // The forward turn
                     turn++;
                     layer_turn++;
                     // Get velocity for current turn
                     auto rpm = get_feed_rate();
-                    // Increment or decrement X position and remeber previous
-                    auto oldx = posx;
-                    posx += (direction ? wire_od : -wire_od);
+                    auto end = program.find(WindOp::Turn, pc);
+                    posx = program[end].x + offset_x;
 
                     // display current turn and layer on LCD
                     display_status(turn, total_turns, layer, layers, posx, rpm);
-
-                    if (cross_section == 0) {
-                        // crossover at the begin of turn
-                        Kinematic::instance.move_to(posx, ((turn-1) + cross_ends), rpm);
-                        Kinematic::instance.move_to(posx, turn, rpm);
-                    } else if (cross_section == (num_csections-1)) {
-                        // crossover at the end of turn
-                        Kinematic::instance.move_to(oldx, ((turn-1) + cross_starts), rpm);
-                        Kinematic::instance.move_to(posx, turn, rpm);
+                    Kinematic::instance.rmotor.add_trigger((unit_t)(program[pc].r + offset_r), 1, nullptr,
+                                                           nullptr, &crossed[ahead++ % WINDING_TURNS_AHEAD]);
+
+                    if (geared) {
+                        // The spindle does not stop, X shifts only
+                        // inside the crossover arc
+                        auto& from = program[pc];
+                        auto& to = program[pc + 1];
+                        auto pitch = (to.x - from.x) / (to.r - from.r);
+                        Kinematic::instance.add_gear_change(from.r + offset_r, pitch);
+                        Kinematic::instance.add_gear_change(to.r + offset_r, 0);
+                        Kinematic::instance.spin_to(program[end].r + offset_r, rpm);
+                        pc = end + 1;
                     } else {
-                        // crossover at the middle of turn
-                        Kinematic::instance.move_to(oldx, ((turn-1) + cross_starts), rpm);
-                        Kinematic::instance.move_to(posx, ((turn-1) + cross_ends), rpm);
-                        Kinematic::instance.move_to(posx, turn, rpm);
+                        // The crossover moves and the end of the turn
+                        for ( ; pc<=end; pc++)
+                            Kinematic::instance.move_to(program[pc].x + offset_x, program[pc].r + offset_r, rpm);
                     }
 
-                } else if (one_turn_dir < 0) {
+                } else if (layer_turn > 0) {
                     // Unwind single turn only for current layer
-                    if (layer_turn > 0) {
-                        // Decrease amount of turns
-                        layer_turn--;
-                        turn--;
-                        // Get the velocity
-                        auto rpm = get_feed_rate();
+                    layer_turn--;
+                    turn--;
+                    // Get the velocity
+                    auto rpm = get_feed_rate();
 
-                        // Increment or decrement X pposition
-                        posx -= (direction ? wire_od : -wire_od);
+                    // Back to the end of the turn before
+                    pc = previous_turn(pc);
+                    auto base = pc - 1;
+                    while (program[base].op == (uint8_t)WindOp::Pause)
+                        base--;
+                    posx = program[base].x + offset_x;
 
-                        // Display the status
-                        display_status(turn, total_turns, layer, layers, posx, rpm);
+                    // Display the status
+                    display_status(turn, total_turns, layer, layers, posx, rpm);
 
-                        // Perform operation
-                        Kinematic::instance.move_to(posx, turn, rpm);
-                    } else {
-                        one_turn_dir = 0;
-                        wind_extra_turns = false;
-                        if (layer > 2) {
-                            layer--;
-                            ESP_LOGW(TAG, "Goto previous layer");
-                            display_status(turn, total_turns, layer, layers, posx, 0);
-                            goto CHANGE_LAYER_BACKWARD;
-                        } else {
-                            ESP_LOGW(TAG, "Unwind all coil");
-                            goto EXIT;
-                        }
-                    }
+                    // Perform operation
+                    Kinematic::instance.move_to(posx, program[base].r + offset_r, rpm);
+
+                } else if (layer > 1) {
+                    // Back to the last nominal turn of the previous layer
+                    one_turn_dir = 0;
+                    wind_extra_turns = false;
+                    ESP_LOGW(TAG, "Goto previous layer");
+                    compile_layer(layer - 1);
+                    auto end = program.find(WindOp::Shift, 0);
+                    posx -= program[end].x;
+                    while (program[end].op != (uint8_t)WindOp::Turn
+                           || (program[end].flags & WIND_FLAG_EXTRA) != 0)
+                        end--;
+                    layer = program[0].layer;
+                    geared = (program[0].flags & WIND_FLAG_CONTINUOUS) != 0;
+                    layer_turn = lroundf(program[end].r - program[0].r);
+                    pause_pc = find_pause();
+                    offset_x = posx - program[end].x;
+                    offset_r = turn - program[end].r;
+                    pc = end + 1;
+                    layer_back = program[pc].op == (uint8_t)WindOp::Shift;
+                    display_status(turn, total_turns, layer, layers, posx, 0);
+                    Kinematic::instance.set_accel_limit(get_spindle_accel(layer));
+                    Kinematic::instance.move_to(posx, turn, get_feed_rate());
+                    continue;
+
+                } else {
+                    ESP_LOGW(TAG, "Unwind all coil");
+                    pc = program.size();
+                    break;
                 }
                 // Deactivate single turn
                 one_turn_dir = 0;
 
                 // Stop autowinding for manual reversing
+                if (pc < program.size() && program[pc].op == (uint8_t)WindOp::Pause)
+                    pc++;
                 if (manual_direct) {
-                    wind_extra_turns = layer_turn >= auto_stop_at;
-                    if (wind_extra_turns)
+                    wind_extra_turns = pc > pause_pc;
+                    if (wind_extra_turns) {
+                        // Each click should make exactly one turn
+                        Kinematic::instance.synchronize();
                         display_message("Manual dir");
+                    }
                 }
+                break;
 
-                //vTaskDelay(1/portTICK_PERIOD_MS);
-            }
-
-            update_feed_rate_norm();
-
-        } while (layer_turn<max_turns && !change_layer);
-
-        ESP_LOGW(TAG, "Change the layer forward");
-        layer_turn = 0;
-        posx += (odd_layer ? xshift_odd : xshift_even);
-        goto AFTER_CHANGE_LAYER;
-
-    CHANGE_LAYER_BACKWARD:
-        ESP_LOGW(TAG, "Change the layer forward");
-        layer_turn = layer_turns;
-        posx -= (odd_layer ? xshift_odd : xshift_even);
+            case WindOp::Pause:
+                pc++;
+                break;
 
-    AFTER_CHANGE_LAYER:
-        reset_feed_rate_norm();
-        Kinematic::instance.move_to(posx, turn, get_feed_rate());
+            case WindOp::End:
+            default:
+                pc = program.size();
+                break;
+        }
     }
-EXIT:
+    Kinematic::instance.synchronize();
+    // The turns unwound before their crossover leave the triggers
+    Kinematic::instance.rmotor.clear_triggers();
     printf("\nCOMPLETE %d LAYERS AND %d TURNS\n", layers, turn);
     winding_task_handle = NULL;
     vTaskDelete(NULL);
@@ -439,6 +693,10 @@ void OrthocyclicRound::start()
     } else {
         ESP_LOGI(TAG, "Start winding task");
         inspect();
+        if (!compile()) {
+            ESP_LOGE(TAG, "The winding program is wrong, the job does not start");
+            return;
+        }
         xTaskCreate(c_winding_task, "winding_task", 4096, this, WINDING_TASK_PRIO, &winding_task_handle);
     }
 }
@@ -448,6 +706,7 @@ void OrthocyclicRound::stop() {
         ESP_LOGI(TAG,"Stop winding");
         vTaskDelete(winding_task_handle);
         winding_task_handle = NULL;
+        Kinematic::instance.stop();
     }
 }
 
@@ -509,7 +768,7 @@ void OrthocyclicRound::update_config() {
             turns += turns_last;
         }
         total_turns = turns;
-        update_coil_od(layer);
+        update_coil_od(wire_layers);
     } else if (bob_od > 0) {
         // Make the coil based on target external diameter
         auto max_od = bob_od - (2*wire_od*sin60);
@@ -558,6 +817,9 @@ void OrthocyclicRound::update_config() {
     }
     // The air gap at the end
     winding_gap = bob_len - winding_len;
+    // The continuous layer takes the wider arc the gear can make
+    continuous_arc = continuous ? get_continuous_arc() : 0;
+    cross_arc = continuous_arc > 0 ? continuous_arc : crossover_size_norm();
     // Display result
     inspect();
 }
@@ -589,4 +851,9 @@ void OrthocyclicRound::inspect()
     printf("  Better wire OD  = %.2f mm\n", better_wire_od);
     printf("  Coil OD         = %.2f mm\n", coil_od);
     printf("  Coil OD cross   = %.2f mm\n", coil_od_cross);
+    printf("  Continuous      = %d\n", continuous);
+    printf("  Crossover arc   = %.3f turn\n", cross_arc);
+    printf("  Wire accel      = %.0f mm/s^2\n", wire_accel);
+    printf("  Spindle accel   = %.2f .. %.2f turns/s^2\n",
+           get_spindle_accel(1), get_spindle_accel(layers));
 }
@@ -11,6 +11,7 @@
 #include "menu_event.h"
 #include "menu_item.h"
 #include "typeslib.h"
+#include "winding_program.h"
 
 /** *******************************************************************/
 /** ((((((((((((((((((((((( ORTHOCYCLIC ROUND ))))))))))))))))))))))) */
@@ -31,6 +32,9 @@ class OrthocyclicRound : public RoundCoil
 
         void on_update_style(StringItem* item, MenuEvent evt);
         void inspect();
+        bool compile();
+        bool compile_layer(int layer);
+        void dump_program();
         void process();
 
         inline bool is_winding() { return winding_task_handle != NULL; }
@@ -41,9 +45,13 @@ class OrthocyclicRound : public RoundCoil
         Style style;
         bool fill_last;
         bool manual_direct;
+        // Wind each layer by the spindle, X follows it by the gear
+        bool continuous;
         int num_csections;
         // For manual direct stop befor end this amount of turns
         int stop_before;
+        // The wire acceleration the tensioner holds (mm/s^2)
+        float wire_accel;
 
         int turns_odd;
         int turns_even;
@@ -59,18 +67,25 @@ class OrthocyclicRound : public RoundCoil
         float winding_h_cross;
         float winding_gap;
         float better_wire_od;
+        // The crossover arc (turns), the continuous mode widens it
+        float cross_arc;
+        // The arc of the continuous mode, zero if the gear can not make it
+        float continuous_arc;
         bool pause;
+        // The layer the winding task streams
+        WindingProgram program;
 private:
 
         float crossover_size_norm();
+        float get_continuous_arc();
         int get_crossover_section_num(int layer);
         float get_crossover_norm(int layer);
         void update_coil_od(int layers);
-        void reset_feed_rate_norm();
-        void update_feed_rate_norm();
-        float get_max_feed_rate();
-        float get_min_feed_rate();
+        float get_spindle_accel(int layer);
         float get_feed_rate();
+        size_t previous_turn(size_t pc);
+        size_t find_pause();
+        int get_layer_turns(int layer);
 
         /** Thread */
         TaskHandle_t winding_task_handle;
@@ -78,7 +93,6 @@ private:
         int one_turn_dir;
         bool change_layer;
         float feed_rate;
-        float feed_rate_norm;
 };
 
 
@@ -0,0 +1,61 @@
+#ifndef RING_BUFFER_H_
+#define RING_BUFFER_H_
+
+#include <atomic>
+
+#include "esp_attr.h"
+
+/**
+ * Fixed size ring buffer. One task pushes the items and the
+ * other one (or the ISR) pops them, without the locks. The
+ * producer publishes the item by the release store of `head`,
+ * the consumer frees the slot by the release store of `tail`.
+ * The SIZE must be power of two, the buffer holds SIZE-1 items.
+ * The step ISRs use it, so it is in IRAM.
+ */
+template<typename T, int SIZE>
+class RingBuffer {
+    static_assert((SIZE & (SIZE - 1)) == 0, "The size must be power of two");
+
+    public:
+        RingBuffer() : head(0), tail(0) {}
+
+        /** Drop all the items (the consumer side) */
+        IRAM_ATTR inline void clear() { tail.store(head.load(std::memory_order_acquire), std::memory_order_release); }
+        IRAM_ATTR inline int size() const {
+            return (head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire)) & (SIZE-1);
+        }
+        IRAM_ATTR inline bool is_empty() const { return size() == 0; }
+        inline bool is_full() const { return size() == SIZE-1; }
+
+        IRAM_ATTR bool push(const T& item) {
+            auto h = head.load(std::memory_order_relaxed);
+            auto next = (h + 1) & (SIZE-1);
+            if (next == tail.load(std::memory_order_acquire))
+                return false;
+            buffer[h] = item;
+            head.store(next, std::memory_order_release);
+            return true;
+        }
+
+        IRAM_ATTR bool pop(T& item) {
+            auto t = tail.load(std::memory_order_relaxed);
+            if (t == head.load(std::memory_order_acquire))
+                return false;
+            item = buffer[t];
+            tail.store((t + 1) & (SIZE-1), std::memory_order_release);
+            return true;
+        }
+
+        /** The item `n` from the oldest one */
+        inline T& at(int n) { return buffer[(tail.load(std::memory_order_acquire) + n) & (SIZE-1)]; }
+        inline T& front() { return at(0); }
+        inline T& back() { return at(size() - 1); }
+
+    private:
+        T buffer[SIZE];
+        std::atomic<int> head;
+        std::atomic<int> tail;
+};
+
+#endif // RING_BUFFER_H_
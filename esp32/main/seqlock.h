@@ -0,0 +1,52 @@
+#ifndef SEQLOCK_H_
+#define SEQLOCK_H_
+
+#include <atomic>
+#include <stdint.h>
+
+#include "esp_attr.h"
+
+/**
+ * The state shared by the single writer with the readers
+ * without the locks. The writer makes the sequence odd, stores
+ * the value and makes it even again, it never waits. The reader
+ * copies the value and retries when the sequence was odd or
+ * changed during the copy.
+ *
+ * The reader spins while the writer is inside `store()`, so the
+ * writer must not be preempted by the reader: the timer callbacks
+ * write and the tasks read.
+ */
+template<typename T>
+class SeqLock {
+    public:
+        SeqLock() : seq(0), value() {}
+
+        /** Store the value (the writer only) */
+        IRAM_ATTR inline void store(const T& v) {
+            auto s = seq.load(std::memory_order_relaxed);
+            seq.store(s + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            value = v;
+            seq.store(s + 2, std::memory_order_release);
+        }
+
+        /** The consistent copy of the value */
+        inline T load() const {
+            T v;
+            uint32_t s0, s1;
+            do {
+                s0 = seq.load(std::memory_order_acquire);
+                v = value;
+                std::atomic_thread_fence(std::memory_order_acquire);
+                s1 = seq.load(std::memory_order_relaxed);
+            } while ((s0 & 1) != 0 || s0 != s1);
+            return v;
+        }
+
+    private:
+        std::atomic<uint32_t> seq;
+        T value;
+};
+
+#endif // SEQLOCK_H_
@@ -0,0 +1,128 @@
+#include "esp_attr.h"
+#include "esp_log.h"
+
+#include "step_clock.h"
+#include "step_motor.h"
+
+static const char TAG[] = "step-clock";
+
+/** The alarm must be ahead of the counter by this ticks */
+#define STEP_HW_TIMER_MIN_LEAD 2
+
+/** Make the clock for the engine */
+StepClock* StepClock::create(StepClockType type, int index) {
+    if (type == StepClockType::HwTimer)
+        return new HwStepClock(index);
+    return new EspStepClock();
+}
+
+/** ******************************************/
+/** The esp_timer clock                      */
+/** ******************************************/
+
+EspStepClock::EspStepClock()
+    : handle(nullptr)
+{}
+
+EspStepClock::~EspStepClock() {
+    if (handle != nullptr) {
+        esp_timer_stop(handle);
+        esp_timer_delete(handle);
+    }
+}
+
+void EspStepClock::init(step_clock_cb_t callback, void* arg, const char* name) {
+    esp_timer_create_args_t args = {};
+    args.callback = callback;
+    args.arg = arg;
+    args.name = name;
+    ESP_ERROR_CHECK(esp_timer_create(&args, &handle));
+    ESP_LOGI(TAG, "[%s] esp_timer step clock", name);
+}
+
+void EspStepClock::start(uint32_t interval_us, bool from_isr) {
+    esp_timer_stop(handle);
+    esp_timer_start_once(handle, interval_us);
+}
+
+void EspStepClock::stop() {
+    esp_timer_stop(handle);
+}
+
+int32_t EspStepClock::min_interval_us() {
+    return MINIMUM_TIMER_INTERVAL_US;
+}
+
+/** ******************************************/
+/** The hardware timer clock                 */
+/** ******************************************/
+
+HwStepClock::HwStepClock(int index)
+    : group((timer_group_t)(index / 2))
+    , timer((timer_idx_t)(index % 2))
+    , callback(nullptr)
+    , arg(nullptr)
+    , alarm(0)
+    , lock(portMUX_INITIALIZER_UNLOCKED)
+{}
+
+static bool IRAM_ATTR c_hw_clock_isr(void* arg) {
+    return ((HwStepClock*)arg)->isr();
+}
+
+void HwStepClock::init(step_clock_cb_t _callback, void* _arg, const char* name) {
+    callback = _callback;
+    arg = _arg;
+    timer_config_t config = {};
+    config.alarm_en = TIMER_ALARM_DIS;
+    config.counter_en = TIMER_PAUSE;
+    config.intr_type = TIMER_INTR_LEVEL;
+    config.counter_dir = TIMER_COUNT_UP;
+    config.auto_reload = TIMER_AUTORELOAD_DIS;
+    config.divider = STEP_HW_TIMER_DIVIDER;
+    ESP_ERROR_CHECK(timer_init(group, timer, &config));
+    ESP_ERROR_CHECK(timer_set_counter_value(group, timer, 0));
+    ESP_ERROR_CHECK(timer_isr_callback_add(group, timer, c_hw_clock_isr, this, ESP_INTR_FLAG_IRAM));
+    ESP_ERROR_CHECK(timer_enable_intr(group, timer));
+    ESP_ERROR_CHECK(timer_start(group, timer));
+    ESP_LOGI(TAG, "[%s] Hardware step clock %d:%d", name, (int)group, (int)timer);
+}
+
+/** The alarm fired, it is disabled until the callback starts it again */
+bool IRAM_ATTR HwStepClock::isr() {
+    callback(arg);
+    return false;
+}
+
+/**
+ * The ISR moves the alarm from the previous one, the task from
+ * the current counter. The late alarm goes right after the counter.
+ */
+void IRAM_ATTR HwStepClock::start(uint32_t interval_us, bool from_isr) {
+    if (from_isr) {
+        portENTER_CRITICAL_ISR(&lock);
+        auto now = timer_group_get_counter_value_in_isr(group, timer);
+        alarm += interval_us;
+        if (alarm < now + STEP_HW_TIMER_MIN_LEAD)
+            alarm = now + STEP_HW_TIMER_MIN_LEAD;
+        timer_group_set_alarm_value_in_isr(group, timer, alarm);
+        timer_group_enable_alarm_in_isr(group, timer);
+        portEXIT_CRITICAL_ISR(&lock);
+    } else {
+        uint64_t now = 0;
+        portENTER_CRITICAL(&lock);
+        timer_get_counter_value(group, timer, &now);
+        alarm = now + (interval_us > STEP_HW_TIMER_MIN_LEAD ? interval_us : STEP_HW_TIMER_MIN_LEAD);
+        timer_set_alarm_value(group, timer, alarm);
+        timer_set_alarm(group, timer, TIMER_ALARM_EN);
+        portEXIT_CRITICAL(&lock);
+    }
+}
+
+void HwStepClock::stop() {
+    timer_set_alarm(group, timer, TIMER_ALARM_DIS);
+}
+
+int32_t HwStepClock::min_interval_us() {
+    return STEP_HW_TIMER_MIN_INTERVAL_US;
+}
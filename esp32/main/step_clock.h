@@ -0,0 +1,88 @@
+#ifndef STEP_CLOCK_H_
+#define STEP_CLOCK_H_
+
+#include <stdint.h>
+
+#include "driver/timer.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+/** The engine which calls the step ISR */
+enum class StepClockType { EspTimer, HwTimer };
+
+/** The shortest interval of the hardware timer (microseconds) */
+#define STEP_HW_TIMER_MIN_INTERVAL_US 5
+/** The hardware timer ticks at 1 MHz (80 MHz APB / 80) */
+#define STEP_HW_TIMER_DIVIDER 80
+
+typedef void (*step_clock_cb_t)(void* arg);
+
+/**
+ * The timer of the step ISR. The ISR calls `start` with the
+ * interval to the next step, the tasks call it to wake up the
+ * idle ISR. The caller tells which of them it is.
+ */
+class StepClock {
+    public:
+        virtual ~StepClock() {}
+
+        virtual void init(step_clock_cb_t callback, void* arg, const char* name) = 0;
+        /** Call the callback after the interval (microseconds) */
+        virtual void start(uint32_t interval_us, bool from_isr) = 0;
+        virtual void stop() = 0;
+        /** The shortest interval the engine sustains (microseconds) */
+        virtual int32_t min_interval_us() = 0;
+
+        /** The highest step rate of the engine (steps/s) */
+        inline float max_rate() { return 1000000.0f / min_interval_us(); }
+
+        static StepClock* create(StepClockType type, int index);
+};
+
+/**
+ * The one-shot esp_timer. Its callback runs in the esp_timer task,
+ * the dispatch overhead limits the interval to 20 us.
+ */
+class EspStepClock : public StepClock {
+    public:
+        EspStepClock();
+        ~EspStepClock() override;
+
+        void init(step_clock_cb_t callback, void* arg, const char* name) override;
+        void start(uint32_t interval_us, bool from_isr) override;
+        void stop() override;
+        int32_t min_interval_us() override;
+
+    private:
+        esp_timer_handle_t handle;
+};
+
+/**
+ * The timer group alarm, the callback runs in the IRAM interrupt,
+ * so the steps go on while the flash cache is off. The whole step
+ * path it calls must be in IRAM and must not log. The ISR moves
+ * the alarm from the previous one, so its own latency does not
+ * shift the steps. The index selects the timer: group is index / 2,
+ * timer is index % 2.
+ */
+class HwStepClock : public StepClock {
+    public:
+        HwStepClock(int index);
+
+        void init(step_clock_cb_t callback, void* arg, const char* name) override;
+        void start(uint32_t interval_us, bool from_isr) override;
+        void stop() override;
+        int32_t min_interval_us() override;
+
+        bool isr();
+
+    private:
+        timer_group_t group;
+        timer_idx_t timer;
+        step_clock_cb_t callback;
+        void* arg;
+        uint64_t alarm;
+        portMUX_TYPE lock;
+};
+
+#endif // STEP_CLOCK_H_
@@ -0,0 +1,312 @@
+#include <stdlib.h>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "config.h"
+#include "motion_trace.h"
+#include "step_dda.h"
+#include "step_motor.h"
+#include "step_motor_config.h"
+
+static const char TAG[] = "dda";
+
+/** ******************************************/
+/** The multi axis stepper                   */
+/** ******************************************/
+
+StepDda::StepDda()
+    : log(0)
+    , isr_count(0)
+    , clock(nullptr)
+    , blocks_pushed(0)
+    , blocks_done(0)
+    , segments_planned(0)
+    , token_done(0)
+    , stop_requested(0)
+    , stop_applied(0)
+    , left(0)
+    , running(false)
+    , claimed(false)
+{
+    segment.steps = 0;
+    block.major = 0;
+    phase.reset();
+}
+
+/** The @arg points to StepDda */
+static void IRAM_ATTR c_dda_isr(void* arg) {
+    ((StepDda*)arg)->isr();
+}
+
+void StepDda::init(StepMotor* x, StepMotor* r) {
+    ESP_LOGI(TAG, "Initialize DDA");
+    motors[0] = x;
+    motors[1] = r;
+    // The hardware timer when any axis has it, the slower axis is
+    // limited by its own max velocity
+    auto type = StepClockType::EspTimer;
+    for (auto motor : motors) {
+        if (motor->config->clock_type == StepClockType::HwTimer)
+            type = StepClockType::HwTimer;
+    }
+    clock = StepClock::create(type, DDA_HW_TIMER);
+    // The timer is started only when there is a move
+    clock->init(&c_dda_isr, this, "step-dda");
+    planner.min_interval = clock->min_interval_us();
+    // The batch waits the pulse in the ISR, as the GPIO backend does
+    if (2 * MOTOR_STEP_PULSE_WIDTH_MS > planner.min_interval)
+        planner.min_interval = 2 * MOTOR_STEP_PULSE_WIDTH_MS;
+    for (auto motor : motors) {
+        auto pulse_period = motor->hal.min_pulse_period();
+        if (pulse_period > planner.min_interval)
+            planner.min_interval = pulse_period;
+    }
+    planner.max_interval = MAXIMUM_TIMER_INTERVAL_US;
+    planner.mode = x->config->accel_profile;
+}
+
+/** Update the stepper every 20ms */
+void StepDda::update() {
+    segments_planned += planner.fill(segments);
+    // The queue was empty too long, continue the move
+    if (!segments.is_empty())
+        start();
+}
+
+/**
+ * Add the block to the execution. The rates and the acceleration
+ * are for the major axis (steps/s). The block starts right after
+ * the previous one.
+ */
+bool StepDda::push(const DdaBlock& _block, float rate, float accel,
+                   float entry_rate, float exit_rate, float jerk) {
+    if (blocks.is_full() || is_planning()) {
+        ESP_LOGE(TAG, "The previous block is not planned yet");
+        return false;
+    }
+    if (_block.major == 0)
+        return true;
+    // After the queue underflow the motion starts from the rest
+    if (!running)
+        entry_rate = 0;
+
+    planner.plan(_block.major, rate, accel, entry_rate, exit_rate, jerk);
+    blocks.push(_block);
+    profiles.push(planner.profile);
+    blocks_pushed++;
+    segments_planned += planner.fill(segments);
+    if (log > 0)
+        ESP_LOGI(TAG, "Block dX:%d dR:%d rate: %f..%f..%f accel: %d decel: %d",
+                 (int)_block.delta[0], (int)_block.delta[1],
+                 planner.profile.entry_rate,
+                 planner.profile.cruise_rate,
+                 planner.profile.exit_rate,
+                 (int)planner.profile.accel_steps,
+                 (int)planner.profile.decel_steps);
+    start();
+    return true;
+}
+
+/**
+ * Drop the current move. The queues belong to the ISR, so the
+ * task sends the request and waits until the ISR takes it.
+ */
+void StepDda::stop() {
+    planner.reset();
+    auto seq = stop_requested + 1;
+    stop_requested = seq;
+    while ((int32_t)(stop_applied - seq) < 0) {
+        // The idle timer does not tick, wake it up
+        start();
+        vTaskDelay(1);
+    }
+}
+
+bool StepDda::is_moving() {
+    return running || blocks_done != blocks_pushed;
+}
+
+/** The planner still makes the segments of last block */
+bool StepDda::is_planning() {
+    return !planner.is_done();
+}
+
+/** The blocks pushed but not complete yet */
+int StepDda::blocks_in_flight() {
+    return (int)(blocks_pushed - blocks_done);
+}
+
+/** Wake up the timer if it is idle */
+void StepDda::start() {
+    if (!running) {
+        running = true;
+        timing.restart();
+        clock->start(MINIMUM_TIMER_INTERVAL_US, false);
+    }
+}
+
+// ==================================================
+// Timer ISR
+// ==================================================
+
+void IRAM_ATTR StepDda::isr() {
+    isr_count++;
+    timing.enter();
+
+    if (stop_applied != stop_requested)
+        apply_stop();
+
+    if (segment.steps == 0) {
+        if (!segments.pop(segment)) {
+            // Nothing to do, the timer stays idle
+            running = false;
+            release_axes();
+            MotionTrace::instance.record(TraceAxis::Dda, TraceEvent::Done, block.major - left);
+            timing.leave(0);
+            return;
+        }
+        if (segment.flags & STEP_SEGMENT_FIRST)
+            load_block();
+        MotionTrace::instance.record(TraceAxis::Dda, TraceEvent::Segment, block.major - left,
+                                     segment.interval,
+                                     (uint16_t)(segment.steps > 0xFFFF ? 0xFFFF : segment.steps));
+    }
+
+    // The motor ISR is inside, step after it
+    if (!claim_axes()) {
+        clock->start(MINIMUM_TIMER_INTERVAL_US, true);
+        timing.leave(MINIMUM_TIMER_INTERVAL_US);
+        return;
+    }
+
+    auto interval = phase.take(segment.interval);
+    clock->start(interval, true);
+    segment.advance();
+    tick();
+    timing.leave(interval);
+}
+
+/**
+ * Take all axes from their motor ISRs, true when all are free.
+ * The step pins of the claimed axes go by the batch.
+ */
+bool IRAM_ATTR StepDda::claim_axes() {
+    auto free = true;
+    for (auto motor : motors)
+        free = motor->claim() && free;
+    if (free && !claimed) {
+        for (auto motor : motors)
+            motor->hal.set_batched(true);
+        claimed = true;
+    }
+    return free;
+}
+
+/** Give the axes back to their motor ISRs and pulse backends */
+void IRAM_ATTR StepDda::release_axes() {
+    if (claimed) {
+        for (auto motor : motors)
+            motor->hal.set_batched(false);
+        claimed = false;
+    }
+    for (auto motor : motors)
+        motor->release();
+}
+
+/** Drop the queues by the stop request (called by ISR) */
+void IRAM_ATTR StepDda::apply_stop() {
+    segments.clear();
+    segment.steps = 0;
+    blocks.clear();
+    profiles.clear();
+    left = 0;
+    blocks_done = blocks_pushed;
+    gear.reset();
+    MotionTrace::instance.record(TraceAxis::Dda, TraceEvent::Stop, 0);
+    stop_applied = stop_requested;
+}
+
+/** Start the next block */
+void IRAM_ATTR StepDda::load_block() {
+    blocks.pop(block);
+    profiles.pop(profile);
+    left = block.major;
+    MotionTrace::instance.record(TraceAxis::Dda, TraceEvent::Block, block.delta[0],
+                                 block.delta[1], (uint16_t)block.token);
+    for (auto i = 0; i < DDA_AXES; i++) {
+        dir[i] = block.delta[i] < 0 ? -1 : 1;
+        count[i] = abs(block.delta[i]);
+        // Start from the middle for the symmetrical steps
+        error[i] = block.major / 2;
+    }
+    if (block.gear.den != 0) {
+        // X steps by the gear, the same ratio continues
+        if (!gear.is_same(block.gear))
+            gear.set(block.gear);
+        count[0] = 0;
+    } else {
+        gear.reset();
+    }
+}
+
+/** The major axis steps each tick, other axes if the error overflows */
+void IRAM_ATTR StepDda::tick() {
+    int8_t steps[DDA_AXES];
+    for (auto i = 0; i < DDA_AXES; i++) {
+        error[i] += count[i];
+        steps[i] = 0;
+        if (error[i] >= block.major) {
+            error[i] -= block.major;
+            steps[i] = dir[i];
+        }
+    }
+    if (gear.is_geared())
+        steps[0] = gear.follow(steps[1]);
+    step_axes(steps);
+    if (--left == 0) {
+        token_done = block.token;
+        blocks_done++;
+    }
+}
+
+/**
+ * Step the axes of the tick together. The direction pins go by
+ * one register write, then the step pins by one write, so their
+ * edges land at the same time. The claimed axes step by the batch
+ * whatever their pulse backend, the others make their own pulses.
+ */
+void IRAM_ATTR StepDda::step_axes(const int8_t* steps) {
+    GpioBatch dir_pins;
+    GpioBatch step_pins;
+    dir_pins.reset();
+    step_pins.reset();
+    bool dir_changed = false;
+    for (auto i = 0; i < DDA_AXES; i++) {
+        if (steps[i] != 0 && motors[i]->hal.add_direction(dir_pins, steps[i] > 0))
+            dir_changed = true;
+    }
+    uint32_t setup_us = 0;
+    if (dir_changed) {
+        commit_gpio(dir_pins);
+        setup_us = MOTOR_DIR_PULSE_DELAY_MS;
+    }
+    for (auto i = 0; i < DDA_AXES; i++) {
+        if (steps[i] != 0 && !motors[i]->hal.add_step(step_pins))
+            motors[i]->hal.pulse(setup_us);
+    }
+    if (!step_pins.is_empty()) {
+        if (setup_us > 0)
+            ets_delay_us(setup_us);
+        commit_gpio(step_pins);
+        ets_delay_us(MOTOR_STEP_PULSE_WIDTH_MS);
+        commit_gpio(step_pins.inverse());
+    }
+    for (auto i = 0; i < DDA_AXES; i++) {
+        if (steps[i] != 0)
+            motors[i]->count_step(steps[i]);
+    }
+}
@@ -0,0 +1,104 @@
+#ifndef STEP_DDA_H_
+#define STEP_DDA_H_
+
+#include <stdint.h>
+
+#include "esp_timer.h"
+
+#include "ring_buffer.h"
+#include "step_clock.h"
+#include "step_gear.h"
+#include "step_planner.h"
+#include "step_timing.h"
+#include "typeslib.h"
+
+#define DDA_AXES 2
+/** The queue of blocks, must be power of two */
+#define DDA_BLOCK_QUEUE_SIZE 8
+
+class StepMotor;
+
+/** The straight move of all axes made by one step clock */
+struct DdaBlock {
+    steps_t delta[DDA_AXES];
+    steps_t major;
+    uint32_t token;
+    GearRatio gear;         // X follows R, when den is not zero
+};
+
+/**
+ * The multi axis stepper with the single timer. The planner
+ * makes the profile for the axis with the most steps (major)
+ * and the other axes follow it by the Bresenham's algorithm.
+ * So all axes start and stop at the same tick.
+ *
+ * The blocks follow each other without gaps. The first segment
+ * of each block has STEP_SEGMENT_FIRST flag and the ISR takes
+ * the next block from the queue when it sees this flag.
+ *
+ * In the geared block X does not follow the Bresenham's line but
+ * the step count of R through the exact ratio. The gear continues
+ * over the blocks with the same ratio.
+ */
+class StepDda {
+    public:
+        StepDda();
+
+        void init(StepMotor* x, StepMotor* r);
+        void update();
+        bool push(const DdaBlock& block, float rate, float accel,
+                  float entry_rate, float exit_rate, float jerk = 0);
+        void stop();
+        bool is_moving();
+        bool is_planning();
+        int blocks_in_flight();
+        /** The step of the current block the ISR makes next */
+        inline steps_t get_block_step() { return block.major - left; }
+
+        void isr();
+
+        StepMotor* motors[DDA_AXES];
+        StepPlanner planner;
+        StepSegmentQueue segments;
+        StepSegment segment;
+        StepPhase phase;
+        RingBuffer<DdaBlock, DDA_BLOCK_QUEUE_SIZE> blocks;
+        DdaBlock block;
+        /** The profiles of the queued blocks and the current one */
+        RingBuffer<StepProfile, DDA_BLOCK_QUEUE_SIZE> profiles;
+        StepProfile profile;
+        StepGear gear;
+        int log;
+        uint32_t isr_count;
+        StepTiming timing;
+        StepClock* clock;
+        /** Counters of the blocks */
+        volatile uint32_t blocks_pushed;
+        volatile uint32_t blocks_done;
+        /** The segments made by the planner */
+        volatile uint32_t segments_planned;
+        /** The token of the last complete block */
+        volatile uint32_t token_done;
+        /** The stop requests of the tasks and the ones the ISR took */
+        volatile uint32_t stop_requested;
+        volatile uint32_t stop_applied;
+
+    private:
+        void start();
+        void tick();
+        void step_axes(const int8_t* steps);
+        void load_block();
+        void apply_stop();
+        bool claim_axes();
+        void release_axes();
+
+        steps_t left;
+        steps_t error[DDA_AXES];
+        steps_t count[DDA_AXES];
+        int8_t dir[DDA_AXES];
+        volatile bool running;
+        /** The axes are claimed and step by the batch (ISR only) */
+        bool claimed;
+};
+
+#endif // STEP_DDA_H_
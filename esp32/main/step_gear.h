@@ -0,0 +1,76 @@
+#ifndef STEP_GEAR_H_
+#define STEP_GEAR_H_
+
+#include <stdint.h>
+
+#include "esp_attr.h"
+
+#include "typeslib.h"
+
+/** The follower makes `num` steps per `den` steps of the leader */
+struct GearRatio {
+    int32_t num;
+    int32_t den;            // Zero when the follower is not geared
+};
+
+/** The ratio changes when the leader comes to the position */
+struct GearChange {
+    steps_t position;
+    GearRatio ratio;
+};
+
+/**
+ * The electronic gear: the follower axis makes the steps by the
+ * step count of the leader. The accumulator keeps the exact
+ * remainder, so after N leader steps the follower makes
+ *
+ *     floor((den/2 + N * num) / den)
+ *
+ * steps, the nearest step to the exact ratio, and does not drift.
+ * The ratio must be |num| <= den, so the follower makes at most
+ * one step per leader step.
+ */
+class StepGear {
+    public:
+        StepGear() { reset(); }
+
+        IRAM_ATTR inline void reset() {
+            ratio.num = 0;
+            ratio.den = 0;
+            acc = 0;
+        }
+        IRAM_ATTR inline bool is_geared() const { return ratio.den != 0; }
+        IRAM_ATTR inline bool is_same(const GearRatio& r) const {
+            return ratio.num == r.num && ratio.den == r.den;
+        }
+        /** Start the ratio from the current position */
+        IRAM_ATTR inline void set(const GearRatio& r) {
+            ratio = r;
+            acc = r.den / 2;
+        }
+        /** The follower step for the leader step `dir` (called by ISR) */
+        IRAM_ATTR inline int8_t follow(int8_t dir) {
+            acc += ratio.num * dir;
+            if (acc >= ratio.den) {
+                acc -= ratio.den;
+                return 1;
+            }
+            if (acc < 0) {
+                acc += ratio.den;
+                return -1;
+            }
+            return 0;
+        }
+        /** The follower steps of `n` leader steps, as `n` calls of follow() */
+        inline steps_t advance(steps_t n) {
+            auto t = (int64_t)acc + (int64_t)ratio.num * n;
+            auto q = t >= 0 ? t / ratio.den : -((ratio.den - 1 - t) / ratio.den);
+            acc = (int32_t)(t - q * ratio.den);
+            return (steps_t)q;
+        }
+
+        GearRatio ratio;
+        int32_t acc;
+};
+
+#endif // STEP_GEAR_H_
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string>
 
+#include "esp_attr.h"
 #include "esp_timer.h"
 
 #include "config.h"
@@ -41,34 +42,104 @@ void StepMotorAgent::init(StepMotor* _motor) {
 }
 
 void StepMotorAgent::move_to(unit_t pos, unit_t _velocity) {
-    target = config->units_to_steps(pos);
-    velocity = abs(_velocity);
-    test_endpoint = false;
-    moving = true;
-    on_step();
-    if (log > 0)
-        ESP_LOGI(TAG, "[%d] Moving to pos %f (steps  %d)", motor->id, pos, (int)target);
+    move_to(config->units_to_steps(pos), _velocity);
 }
 
-void StepMotorAgent::move_to(steps_t pos, unit_t _velocity) {
-    target = pos;
-    velocity = abs(_velocity);
-    test_endpoint = false;
-    moving = true;
-    on_step();
+/**
+ * Send the move to the ISR and wait until it takes the move. With
+ * `test_endpoint` the endstop stops the move.
+ */
+void StepMotorAgent::move_to(steps_t pos, unit_t _velocity, bool _test_endpoint) {
+    if (config->use_planner) {
+        motor->plan_move_to(pos, abs(_velocity), _test_endpoint);
+    } else {
+        StepMotorCommand cmd;
+        cmd.type = StepCommandType::Move;
+        cmd.tag = 0;
+        cmd.flag = _test_endpoint;
+        cmd.value = pos;
+        cmd.velocity = abs(_velocity);
+        motor->wait_applied(motor->send(cmd));
+    }
     if (log > 0)
-        ESP_LOGI(TAG, "[%d] Moving to %d", motor->id, (int)target);
+        ESP_LOGI(TAG, "[%d] Moving to %d", motor->id, (int)pos);
 }
 
 void StepMotorAgent::set_test_endpoint(bool v) {
-    test_endpoint = v;
+    StepMotorCommand cmd;
+    cmd.type = StepCommandType::TestEndpoint;
+    cmd.flag = v;
+    motor->send(cmd);
+}
+
+void StepMotorAgent::stop() {
+    if (motor == nullptr)
+        return;
+
+    StepMotorCommand cmd;
+    cmd.type = StepCommandType::Stop;
+    if (config->use_planner) {
+        xSemaphoreTake(motor->control_mutex, portMAX_DELAY);
+        motor->planner.reset();
+        motor->has_pending = false;
+        xSemaphoreGive(motor->control_mutex);
+    }
+    motor->send(cmd);
+}
+
+/** Execute the command of the task (called by ISR) */
+void IRAM_ATTR StepMotorAgent::apply(const StepMotorCommand& cmd) {
+    switch (cmd.type) {
+    case StepCommandType::Move:
+        target = cmd.value;
+        velocity = cmd.velocity;
+        test_endpoint = cmd.flag;
+        motor->arm_endstop(cmd.flag);
+        moving = true;
+        motor->trace(TraceEvent::Move, target, cmd.tag);
+        if (config->use_planner)
+            motor->switch_segments(cmd.tag);
+        // The segments of the move may be done already
+        on_step();
+        break;
+    case StepCommandType::Stop:
+        halt();
+        // The triggers of the dropped motion would hold the slots
+        motor->drop_triggers(cmd.triggers);
+        break;
+    case StepCommandType::SetPosition:
+        motor->position = cmd.value;
+        // The triggers of the old positions expire
+        motor->drop_triggers(cmd.triggers);
+        break;
+    case StepCommandType::TestEndpoint:
+        test_endpoint = cmd.flag;
+        motor->arm_endstop(cmd.flag);
+        break;
+    case StepCommandType::ClearTriggers:
+        motor->drop_triggers(cmd.triggers);
+        break;
+    }
 }
 
-void StepMotorAgent::on_step() {
+/** Check the target after the step (called by ISR) */
+void IRAM_ATTR StepMotorAgent::on_step() {
     if (motor == nullptr)
         return;
 
-    if (moving) {
+    if (moving && config->use_planner) {
+        // The planner already knows the target, just wait until
+        // the last segment is done. The last segment of the
+        // replaced move does not complete the new one
+        auto& segment = motor->segment;
+        if (segment.steps == 0 && (segment.flags & STEP_SEGMENT_LAST) != 0
+            && segment.tag == motor->next_tag) {
+            moving = false;
+            motor->trace(TraceEvent::Done);
+        }
+
+        motor->check_endstop();
+    } else if (moving) {
         if (target < motor->position) {
             motor->set_target_velocity(-velocity);
         } else if (target > motor->position) {
@@ -76,23 +147,22 @@ void StepMotorAgent::on_step() {
         } else {
             motor->set_target_velocity(0);
             moving = false;
-            if (log > 0)
-                ESP_LOGI(TAG, "[%d] Moving complete", motor->id);
+            motor->trace(TraceEvent::Done);
         }
 
-        if (test_endpoint && motor->hal.get_endpoint())
-            stop();
+        motor->check_endstop();
     }
 }
 
-void StepMotorAgent::stop() {
-    if (motor == nullptr)
-        return;
-
-    if (moving) {
-        moving = false;
-        motor->set_target_velocity(0);
-    }
+/** Stop right now (called by ISR) */
+void IRAM_ATTR StepMotorAgent::halt() {
+    if (moving)
+        motor->trace(TraceEvent::Halt);
+    test_endpoint = false;
+    moving = false;
+    motor->set_target_velocity(0);
+    if (config->use_planner)
+        motor->drop_segments(0);
 }
 
 // }}}
@@ -102,16 +172,17 @@ void StepMotorAgent::stop() {
 /** ******************************************/
 
 StepMotor::StepMotor()
-    : speed(1) {
+    : speed(1)
+    , clock(nullptr) {
 }
 
 /** The @arg points to motor_t structure */
-static void  c_timer_isr(void* arg) {
+static void IRAM_ATTR c_timer_isr(void* arg) {
     ((StepMotor*)arg)->isr();
 }
-/** C-homing task */
-static void c_homing_task(void* arg) {
-    ((StepMotor*)arg)->homing_task();
+/** The edge of the endstop pin */
+static void c_endstop_isr(void* arg) {
+    ((StepMotor*)arg)->endstop_isr();
 }
 
 
@@ -126,14 +197,61 @@ void StepMotor::init(StepMotorConfig* _config) {
     // Reset the motor's status
     target_velocity = 0;
     velocity = 0;
+    acceleration = 0;
     position = 0;
+    // The channel to the ISR
+    control_mutex = xSemaphoreCreateMutex();
+    command_seq = 0;
+    move_tag = 0;
+    active_tag = 0;
+    next_tag = 0;
+    plan_start = 0;
+    queued_tag = 0;
+    has_pending = false;
+    last_interval = 0;
+    last_dir = 0;
+    applied_seq = 0;
+    claimed = false;
+    isr_active = false;
+    run_dir = 0;
+    triggers_added = 0;
+    triggers_armed = 0;
+    triggers_taken = 0;
+    endstop_armed = false;
+    endstop_edge = false;
+    endstop_hit = false;
+    edge_position = 0;
+    edge_time_us = 0;
+    endstop_position = 0;
+    endstop_time_us = 0;
+    endstop_irq = hal.init_endstop_interrupt(c_endstop_isr, this);
+    homing_state = HomingState::Idle;
+    homing_error = HomingError::None;
+    homing_pass = 0;
+    homing_attempt = 0;
+    homing_wait_until = 0;
     // Configure timer
-    timer_arg.callback = &c_timer_isr;
-    timer_arg.arg = this;
-    ESP_ERROR_CHECK(esp_timer_create(&timer_arg, &timer_handle));
+    clock = StepClock::create(config->clock_type, config->clock_index);
+    clock->init(&c_timer_isr, this, "step-motor");
+    // Configure the planner
+    // The step rate is limited by the ISR engine and the pulse backend
+    auto pulse_period = hal.min_pulse_period();
+    auto clock_period = clock->min_interval_us();
+    planner.min_interval = pulse_period > clock_period ? pulse_period : clock_period;
+    planner.max_interval = MAXIMUM_TIMER_INTERVAL_US;
+    planner.mode = config->accel_profile;
+    auto max_velocity = get_max_step_rate() / config->units_to_fsteps(1);
+    if (config->max_velocity > max_velocity) {
+        ESP_LOGW(TAG, "[%d] The max velocity is limited to %f by %.0f steps/s",
+                 id, max_velocity, get_max_step_rate());
+        config->max_velocity = max_velocity;
+    }
+    segment.steps = 0;
+    segment.flags = 0;
+    publish();
     /* Start the timers */
-    timer_interval_us = TIMER_IDLE_DELAY_US;
-    ESP_ERROR_CHECK(esp_timer_start_periodic(timer_handle, timer_interval_us));
+    timer_interval = TIMER_IDLE_DELAY_US << STEP_INTERVAL_SHIFT;
+    clock->start(TIMER_IDLE_DELAY_US, false);
 }
 
 /** Initialize menu system */
@@ -160,17 +278,40 @@ void StepMotor::init_menu(std::string path) {
                             [&]() { return (float)get_target_velocity(); },
                             [&](float v) { set_target_velocity((unit_t)v); }));
     menu->get_last<FloatItem>().set_step(1).set_precision(0);
+    // Acceleration profile
+    menu->add(new IntItem(menu, "profile",
+                          [&] () -> int { return (int)planner.mode; },
+                          [&](int v) { planner.mode = (AccelProfile)clamp(v, 0, 2); }));
     // Log
     menu->add(new IntItem(menu, "log",
                           [&] () -> int { return log; },
                           [&](int v) { log = v; }));
+    // The homing progress
+    menu->add(new IntItem(menu, "-homing",
+                          [&] () -> int { return (int)homing_state; }, nullptr));
+    menu->add(new IntItem(menu, "-homing-err",
+                          [&] () -> int { return (int)homing_error; }, nullptr));
 }
 
 /** Update the motor even 20ms */
 void StepMotor::update(float time) {
     delta_time = time - previous_update_at;
     previous_update_at = time;
-    update_velocity(time);
+    if (config->use_planner) {
+        // Keep the ISR's queue ahead of the motor
+        xSemaphoreTake(control_mutex, portMAX_DELAY);
+        fill_segments();
+        xSemaphoreGive(control_mutex);
+        // The velocity only for the status display
+        auto s = get_state();
+        if (s.running && s.interval > 0)
+            velocity = s.dir * config->steps_to_units(1) * (1000000.0f / s.interval);
+        else
+            velocity = 0;
+    } else {
+        update_velocity(time);
+    }
+    update_homing(time);
 }
 
 // ==================================================
@@ -178,11 +319,11 @@ void StepMotor::update(float time) {
 // ==================================================
 
 unit_t StepMotor::get_position() {
-    return config->steps_to_units(position);
+    return config->steps_to_units(get_state().position);
 }
 // {{{
 unit_t StepMotor::get_target_position() {
-    return config->steps_to_units(agent.target);
+    return config->steps_to_units(get_state().target);
 }
 void StepMotor::set_target_position(unit_t pos) {
     agent.move_to(pos, config->max_velocity);
@@ -192,7 +333,7 @@ void StepMotor::set_target_position(unit_t pos) {
 unit_t StepMotor::get_target_velocity() {
     return target_velocity;
 }
-void StepMotor::set_target_velocity(unit_t vel) {
+void IRAM_ATTR StepMotor::set_target_velocity(unit_t vel) {
     target_velocity = vel;
 }
 // }}}
@@ -218,7 +359,7 @@ bool StepMotor::get_endpoint() {
     return hal.get_endpoint();
 }
 bool StepMotor::is_moving() {
-    return agent.moving;
+    return get_state().moving;
 }
 bool StepMotor::is_moving_home() {
     return get_direction(target_velocity) == get_direction(config->homing_dir);
@@ -241,14 +382,19 @@ bool StepMotor::verify_timer_interval(uint64_t &interval) {
         interval = MAXIMUM_TIMER_INTERVAL_US;
         ESP_LOGW(TAG, "[%d] The timer interval is too big", id);
         return false;
-    } else if (interval < MINIMUM_TIMER_INTERVAL_US) {
-        interval = MINIMUM_TIMER_INTERVAL_US;
+    } else if (interval < (uint64_t)planner.min_interval) {
+        interval = planner.min_interval;
         ESP_LOGE(TAG, "[%d] The timer interval is too small", id);
         return false;
     }
     return true;
 }
 
+/** The highest step rate of the ISR engine and the pulse backend */
+float StepMotor::get_max_step_rate() {
+    return 1000000.0f / planner.min_interval;
+}
+
 /** make current velocity ecual to desired velocity */
 void StepMotor::update_velocity(float time) {
     float old_velocity = velocity * speed;
@@ -258,11 +404,31 @@ void StepMotor::update_velocity(float time) {
     // compute acceleration
     auto accel = config->max_accel * delta_time;
 
-    // apply acceleration to velocity
-    velocity += accel * accdir;
+    if (config->accel_profile == AccelProfile::SCurve && config->max_jerk > 0) {
+        // Steer the acceleration, so it becomes zero when the
+        // velocity reaches the target
+        auto brake = acceleration * fabs(acceleration) / (2 * config->max_jerk);
+        auto target_accel = get_direction(veldif - brake) * config->max_accel;
+        auto jerk = config->max_jerk * delta_time;
+        if (fabs(target_accel - acceleration) < jerk)
+            acceleration = target_accel;
+        else
+            acceleration += jerk * get_direction(target_accel - acceleration);
+        velocity += acceleration * delta_time;
+        // Do not overshoot the target
+        if (get_direction(target_velocity - velocity) != accdir) {
+            velocity = target_velocity;
+            acceleration = 0;
+        }
+    } else {
+        // apply acceleration to velocity
+        velocity += accel * accdir;
+        if (fabs(target_velocity - velocity) < accel)
+            velocity = target_velocity;
+    }
 
-    if (fabs(target_velocity - velocity) < accel) {
-        velocity = target_velocity;
+    if (velocity == target_velocity) {
+        acceleration = 0;
     } else {
         // limit velocity
         if (accdir > 0) {
@@ -277,22 +443,23 @@ void StepMotor::update_velocity(float time) {
     auto new_velocity = velocity * speed;
     // Restart the timer
     if (new_velocity != old_velocity) {
-
-        if (new_velocity == 0) {
-            timer_interval_us = TIMER_IDLE_DELAY_US;
-        } else {
+        uint64_t interval = TIMER_IDLE_DELAY_US;
+        uint32_t fixed = TIMER_IDLE_DELAY_US << STEP_INTERVAL_SHIFT;
+        if (new_velocity != 0) {
             float steps_per_sec = config->units_to_fsteps(abs(new_velocity));
-            if (log > 3)
-                printf("[%d] steps-per-sec: %f\n", id, steps_per_sec);
-            timer_interval_us = (uint64_t)(((double)1.0 / steps_per_sec) * 1000000);
-            verify_timer_interval(timer_interval_us);
+            // The fraction of the microsecond is not truncated,
+            // the ISR carries it to the next step
+            auto exact = 1000000.0 / steps_per_sec;
+            interval = (uint64_t)exact;
+            if (verify_timer_interval(interval))
+                fixed = (uint32_t)llround(exact * STEP_INTERVAL_ONE);
+            else
+                fixed = (uint32_t)interval << STEP_INTERVAL_SHIFT;
         }
-        if (log > 2)
-            printf("[%d] tgt-vel: %f vel: %f interval:  %lf\n", id, target_velocity, velocity,(double)timer_interval_us);
-
-        // Restart the timer
-        //esp_timer_stop(timer_handle);
-        //esp_timer_start_once(timer_handle, timer_interval_us);
+        // The ISR reads the direction first, so the step with old
+        // interval goes at most once
+        timer_interval = fixed;
+        run_dir = get_direction(new_velocity);
     }
 }
 
@@ -300,37 +467,424 @@ void StepMotor::update_velocity(float time) {
 // Timer ISR
 // ==================================================
 
-void StepMotor::isr() {
+void IRAM_ATTR StepMotor::isr() {
+    // The flag goes first, so the DDA sees it or this ISR sees the claim
+    isr_active = true;
+    if (claimed)
+        clock->start(TIMER_IDLE_DELAY_US, true);
+    else
+        tick();
+    isr_active = false;
+}
+
+/**
+ * Take the axis for the DDA (called by the DDA ISR). True when the
+ * motor ISR is not running, then the caller is the only writer until
+ * the release. Else the caller tries again later.
+ */
+bool IRAM_ATTR StepMotor::claim() {
+    claimed = true;
+    return !isr_active;
+}
+
+/** Give the axis back to the motor ISR (called by the DDA ISR) */
+void IRAM_ATTR StepMotor::release() {
+    claimed = false;
+}
+
+void IRAM_ATTR StepMotor::tick() {
     // Just for debugging update the value
     isr_count++;
-    esp_timer_stop(timer_handle);
-    esp_timer_start_once(timer_handle, timer_interval_us);
+    timing.enter();
+    apply_commands();
+
+    // The endstop edge came after the last step, stop before the next one
+    check_endstop();
+
+    // Take the next planned segment. The next move takes over at
+    // its first segment, the segments of the dropped moves are skipped
+    while (segment.steps == 0 && segments.pop(segment)) {
+        if (segment.tag == next_tag)
+            active_tag = next_tag;
+        if (segment.tag != active_tag) {
+            segment.steps = 0;
+            segment.flags = 0;
+        } else {
+            trace(TraceEvent::Segment, segment.dir * segment.interval,
+                  (uint16_t)(segment.steps > 0xFFFF ? 0xFFFF : segment.steps));
+        }
+    }
+
+    if (segment.steps > 0) {
+        // Every step of segment has own interval
+        auto interval = phase.take(segment.interval);
+        clock->start(interval, true);
+        last_interval = interval;
+        last_dir = segment.dir;
+        segment.advance();
+        step(segment.dir);
+        timing.leave(interval);
+        return;
+    }
+
+    uint32_t interval = phase.take(timer_interval);
+    clock->start(interval, true);
+
+    int8_t dir = run_dir;
+    if (agent.moving && dir != 0) {
+        last_interval = interval;
+        last_dir = dir;
+        step(dir);
+    } else {
+        // Keep the rate of the replaced move until its
+        // segments come
+        if (!agent.moving)
+            last_interval = 0;
+        publish();
+    }
+    timing.leave(interval);
+}
+
+/** Take the commands of the tasks */
+void IRAM_ATTR StepMotor::apply_commands() {
+    StepMotorCommand cmd;
+    while (commands.pop(cmd)) {
+        agent.apply(cmd);
+        applied_seq = cmd.seq;
+    }
+}
+
+/** Publish the state to the tasks */
+void IRAM_ATTR StepMotor::publish() {
+    StepMotorState s;
+    s.position = position;
+    s.target = agent.target;
+    s.interval = last_interval;
+    s.dir = last_dir;
+    s.moving = agent.moving;
+    s.running = segment.steps > 0 || !segments.is_empty();
+    s.tag = active_tag;
+    s.applied = applied_seq;
+    state.store(s);
+}
+
+/** Make single step to the direction */
+void IRAM_ATTR StepMotor::step(int dir) {
+    // Set direction and make idle if the pin was changed
+    bool ndir = dir > 0;
+    bool odir = hal.get_direction();
+    hal.set_direction(ndir);
+
+    // The backend makes the pulse, the hardware one does not wait
+    hal.pulse(ndir != odir ? MOTOR_DIR_PULSE_DELAY_MS : 0);
+    count_step(dir);
+}
+
+/** Count the step made by the hardware (called by ISR) */
+void IRAM_ATTR StepMotor::count_step(int dir) {
+    // compure the position in units
+    position += dir;
+    check_triggers(dir);
+    agent.on_step();
+    publish();
+}
+
+// ==================================================
+// Position triggers
+// ==================================================
+
+/**
+ * Fire the triggers at the new position (called by ISR). Only
+ * few triggers are watched, the rest waits in the queue.
+ */
+void IRAM_ATTR StepMotor::check_triggers(int dir) {
+    while (triggers_armed < STEP_TRIGGERS_MAX && new_triggers.pop(triggers[triggers_armed])) {
+        triggers_armed++;
+        triggers_taken++;
+    }
+    for (auto i = 0; i < triggers_armed; ) {
+        auto& trigger = triggers[i];
+        if (trigger.position != position || (trigger.dir != 0 && trigger.dir != dir)) {
+            i++;
+            continue;
+        }
+        auto fired = trigger;
+        trigger = triggers[--triggers_armed];
+        trace(TraceEvent::Trigger);
+        if (fired.flag != nullptr)
+            *fired.flag = true;
+        if (fired.callback != nullptr)
+            fired.callback(this, fired.arg);
+    }
+}
+
+/** Drop the first `count` triggers ever added (called by ISR) */
+void IRAM_ATTR StepMotor::drop_triggers(uint32_t count) {
+    for (auto i = 0; i < triggers_armed; ) {
+        if ((int32_t)(triggers[i].seq - count) > 0)
+            i++;
+        else
+            triggers[i] = triggers[--triggers_armed];
+    }
+    StepTrigger trigger;
+    while ((int32_t)(count - triggers_taken) > 0 && new_triggers.pop(trigger))
+        triggers_taken++;
+}
+
+/**
+ * Fire the callback and set the flag right after the step which
+ * brings the motor to the position. The trigger fires once, the
+ * direction 0 matches the steps of both directions. The stop and
+ * the new position drop the triggers which have not fired.
+ */
+void StepMotor::add_trigger(steps_t pos, int8_t dir, step_trigger_cb_t callback,
+                            void* arg, volatile bool* flag) {
+    StepTrigger trigger;
+    trigger.position = pos;
+    trigger.dir = dir;
+    trigger.callback = callback;
+    trigger.arg = arg;
+    trigger.flag = flag;
+    if (flag != nullptr)
+        *flag = false;
+    xSemaphoreTake(control_mutex, portMAX_DELAY);
+    trigger.seq = triggers_added + 1;
+    while (!new_triggers.push(trigger))
+        vTaskDelay(1);
+    triggers_added++;
+    xSemaphoreGive(control_mutex);
+}
+
+void StepMotor::add_trigger(unit_t pos, int8_t dir, step_trigger_cb_t callback,
+                            void* arg, volatile bool* flag) {
+    add_trigger(config->units_to_steps(pos), dir, callback, arg, flag);
+}
+
+/** Drop all the triggers added so far */
+void StepMotor::clear_triggers() {
+    StepMotorCommand cmd;
+    cmd.type = StepCommandType::ClearTriggers;
+    wait_applied(send(cmd));
+}
+
+// ==================================================
+// The command channel
+//
+// The timer callbacks (this motor's ISR or the DDA, when it has
+// claimed the axis) are the only writers of the state, the tasks
+// read the snapshot and send the commands. The commands wait
+// while the DDA has the axis.
+// ==================================================
+
+/** The consistent state of the motor */
+StepMotorState StepMotor::get_state() {
+    return state.load();
+}
+
+/** Queue the command to the ISR, return its sequence number */
+uint32_t StepMotor::send(StepMotorCommand& cmd) {
+    xSemaphoreTake(control_mutex, portMAX_DELAY);
+    cmd.seq = ++command_seq;
+    cmd.triggers = triggers_added;
+    while (!commands.push(cmd))
+        vTaskDelay(1);
+    xSemaphoreGive(control_mutex);
+    return cmd.seq;
+}
+
+/** Wait until the ISR takes the command */
+void StepMotor::wait_applied(uint32_t seq) {
+    while (true) {
+        auto s = get_state();
+        if ((int32_t)(s.applied - seq) >= 0)
+            return;
+        // The idle timer ticks slowly, wake it up
+        if (!s.moving && !s.running) {
+            clock->start(MINIMUM_TIMER_INTERVAL_US, false);
+        }
+        vTaskDelay(1);
+    }
+}
+
+// ==================================================
+// Planned motion
+// ==================================================
+
+/**
+ * Replace current motion by the planned move. The new move goes
+ * after the queued segments, from their end and by their rate, so
+ * the motor does not stop. The ISR takes the new move at its first
+ * segment. When the new move turns back (or can not stop in its
+ * distance) the queued move stops first, and the faster one slows
+ * down to the new rate. The new move goes from there.
+ */
+void StepMotor::plan_move_to(steps_t target, unit_t _velocity, bool test_endpoint) {
+    auto rate = config->units_to_fsteps(abs(_velocity * speed));
+    auto accel = config->units_to_fsteps(config->max_accel);
+    auto jerk = config->units_to_fsteps(config->max_jerk);
+
+    StepMotorCommand cmd;
+    cmd.type = StepCommandType::Move;
+    cmd.flag = test_endpoint;
+    cmd.value = target;
+    cmd.velocity = abs(_velocity);
+    xSemaphoreTake(control_mutex, portMAX_DELAY);
+    // The ISR keeps the running move and the next one, so the
+    // previous replacement must take over first
+    auto s = get_state();
+    while (s.running && s.tag != queued_tag) {
+        xSemaphoreGive(control_mutex);
+        vTaskDelay(1);
+        xSemaphoreTake(control_mutex, portMAX_DELAY);
+        s = get_state();
+    }
+    move_tag = move_tag == UINT8_MAX ? 1 : move_tag + 1;
+    cmd.tag = move_tag;
+    xSemaphoreGive(control_mutex);
+    // The ISR takes the segments of the tag after the command
+    wait_applied(send(cmd));
 
-    if (agent.moving && velocity!=0) {
-        // Set direction and make idle if the pin was changed
-        bool ndir = velocity > 0;
-        bool odir = hal.get_direction();
-        hal.set_direction(ndir);
+    xSemaphoreTake(control_mutex, portMAX_DELAY);
+    if (cmd.tag != move_tag) {
+        // Replaced by the other task already
+        xSemaphoreGive(control_mutex);
+        return;
+    }
+    // The queued segments end here, the motor comes there by this rate
+    s = get_state();
+    auto queued = s.tag != 0 && (s.running || !planner.is_done() || has_pending);
+    steps_t from = s.position;
+    float entry = 0;
+    int8_t dir = 0;
+    if (queued) {
+        from = plan_start + planner.get_dir() * planner.get_emitted();
+        entry = planner.emitted_rate();
+        dir = planner.get_dir();
+    }
+    has_pending = false;
+    auto distance = target - from;
+    if (distance == 0 && entry == 0) {
+        // The queued move ends at the target, or there is no motion
+        xSemaphoreGive(control_mutex);
+        if (queued) {
+            cmd.tag = queued_tag;
+        } else {
+            cmd.type = StepCommandType::Stop;
+        }
+        send(cmd);
+        return;
+    }
+    // The steps of the queued move to stop or to slow down
+    steps_t ramp = 0;
+    float ramp_exit = 0;
+    auto stop = planner.ramp_distance(0, entry, accel, jerk);
+    if (entry > 0 && (get_direction(distance) != dir || stop > abs(distance))) {
+        ramp = (steps_t)ceilf(stop);
+    } else if (entry > rate) {
+        ramp = (steps_t)ceilf(planner.ramp_distance(rate, entry, accel, jerk));
+        ramp_exit = rate;
+        if (ramp >= abs(distance)) {
+            // No room to cruise, just stop at the target
+            ramp = abs(distance);
+            ramp_exit = 0;
+        }
+    }
+    plan_start = from;
+    auto left = target - (from + dir * ramp);
+    if (ramp > 0 && left != 0) {
+        planner.plan(dir * ramp, entry, accel, entry, ramp_exit, jerk);
+        planner.tag = queued_tag;
+        pending.distance = left;
+        pending.rate = rate;
+        pending.entry_rate = ramp_exit;
+        pending.accel = accel;
+        pending.jerk = jerk;
+        pending.tag = cmd.tag;
+        has_pending = true;
+    } else if (ramp > 0) {
+        // The stop itself comes to the target
+        planner.plan(distance, entry, accel, entry, 0, jerk);
+        planner.tag = cmd.tag;
+    } else {
+        planner.plan(distance, rate, accel, entry, 0, jerk);
+        planner.tag = cmd.tag;
+    }
+    fill_segments();
+    xSemaphoreGive(control_mutex);
+    start_segments();
+    if (log > 2)
+        printf("[%d] plan steps: %d from: %d entry: %f rate: %f stop: %d\n", id, (int)distance,
+               (int)from, entry, planner.profile.cruise_rate, (int)ramp);
+}
 
-        if (ndir != odir)
-            ets_delay_us(MOTOR_DIR_PULSE_DELAY_MS);
+/**
+ * Push the planned segments ahead of the motor, then start the
+ * pending move. The newer move replaces it, so it waits for that
+ * one (called with control_mutex).
+ */
+void StepMotor::fill_segments() {
+    auto s = get_state();
+    auto made = s.tag == planner.tag ? (s.position - plan_start) * planner.get_dir() : 0;
+    made = made < 0 ? 0 : made;
+    auto until = made + planner.ahead_steps(STEP_MOTOR_PLAN_AHEAD_MS / 1000.0f);
+    if (planner.fill(segments, until) > 0)
+        queued_tag = planner.tag;
+    if (has_pending && pending.tag == move_tag && planner.is_done()) {
+        plan_start += planner.get_dir() * planner.profile.steps;
+        planner.plan(pending.distance, pending.rate, pending.accel,
+                     pending.entry_rate, 0, pending.jerk);
+        planner.tag = pending.tag;
+        has_pending = false;
+        if (planner.fill(segments, planner.ahead_steps(STEP_MOTOR_PLAN_AHEAD_MS / 1000.0f)) > 0)
+            queued_tag = planner.tag;
+    }
+}
 
-        hal.set_step(true);
-        ets_delay_us(MOTOR_STEP_PULSE_WIDTH_MS);
-        hal.set_step(false);
-        // compure the position in units
-        position += get_direction(velocity);
-        agent.on_step();
+/** Wake up the timer if it is idle */
+void StepMotor::start_segments() {
+    auto s = get_state();
+    if (!s.running) {
+        timing.restart();
+        clock->start(MINIMUM_TIMER_INTERVAL_US, false);
     }
 }
 
+/** Drop all the segments, only the move `tag` goes on (called by ISR) */
+void IRAM_ATTR StepMotor::drop_segments(uint8_t tag) {
+    active_tag = tag;
+    next_tag = tag;
+    segment.steps = 0;
+    segment.flags = 0;
+}
+
+/**
+ * The move `tag` takes over at its first segment, the segments
+ * queued before it run to the end (called by ISR)
+ */
+void IRAM_ATTR StepMotor::switch_segments(uint8_t tag) {
+    next_tag = tag;
+}
+
+bool StepMotor::is_running_segments() {
+    return get_state().running || !planner.is_done() || has_pending;
+}
+
 // ==================================================
 // Moving to the target point
 // ==================================================
 
 void StepMotor::set_origin()
 {
-    position = 0;
+    set_position(0);
+}
+
+/** Set the position when the ISR takes it */
+void StepMotor::set_position(steps_t pos)
+{
+    StepMotorCommand cmd;
+    cmd.type = StepCommandType::SetPosition;
+    cmd.value = pos;
+    wait_applied(send(cmd));
 }
 
 /** Move motor to position with this velocity */
@@ -345,62 +899,221 @@ void StepMotor::move_to(unit_t position, unit_t velocity) {
 
 /** Move motor to position with this velocity */
 void StepMotor::move_to_rel(steps_t _position, unit_t velocity) {
-    agent.move_to(position + _position, velocity);
+    agent.move_to(get_state().position + _position, velocity);
 }
 
 /** Move motor to position */
 void StepMotor::move_to_rel(unit_t _position, unit_t velocity) {
-    agent.move_to(position + config->units_to_steps(_position), velocity);
+    agent.move_to(get_state().position + config->units_to_steps(_position), velocity);
 }
 // ==================================================
 // The homing process
 // ==================================================
 
-#define HOMING_TASK_PRIO 2
-
-void StepMotor::homing_task() {
-    ESP_LOGI(TAG, "Start Homing...  (homing_dir=%d)",config->homing_dir);
-    auto retract = abs(config->homing_retract_dist);
-    auto maxpos = abs(config->position_max);
-    uint64_t delay = 1 / portTICK_PERIOD_MS;
-    // prehoming
-    ESP_LOGI(TAG, "Homing [Prehoming]");
-    move_to_rel((unit_t)(retract * -config->homing_dir), config->homing_speed);
-    while (agent.moving)
-        vTaskDelay(delay);
-
-    // homing 1
-    ESP_LOGI(TAG, "Homing [Homing 1]");
-    move_to_rel((unit_t)(5 * maxpos*config->homing_dir), config->homing_speed);
-    agent.set_test_endpoint(true);
-    while (!get_endpoint())
-        vTaskDelay(delay);
-
-    // retract
-    ESP_LOGI(TAG, "Homing [Retract]");
-    move_to_rel((unit_t)(retract * -config->homing_dir), config->second_homing_speed);
-    while (agent.moving)
-        vTaskDelay(delay);
-
-    // homing 2
-    ESP_LOGI(TAG, "Homing [Homing 2]");
-    move_to_rel((unit_t)(2 * retract * config->homing_dir), config->homing_speed);
-    agent.set_test_endpoint(true);
-    while (agent.moving)
-        vTaskDelay(delay);
-    // done
-    ESP_LOGI(TAG, "Homing [Done]");
-    position = config->position_endstop;
-    homing_task_handle = NULL;
-    vTaskDelete(NULL);
-}
-
-void StepMotor::move_to_home() {
-    ESP_LOGI(TAG, "Start homing task");
-    if (homing_task_handle != NULL) {
-        vTaskDelete(homing_task_handle);
-        homing_task_handle = NULL;
-    }
-    xTaskCreate(c_homing_task, "homing_task", 4096, this, HOMING_TASK_PRIO, &homing_task_handle);
+static const char* homing_state_names[] = {
+    "idle", "prehoming", "seek", "debounce", "retract", "done", "failed"
+};
+
+/**
+ * Start the homing, update() advances it. The motors home in
+ * parallel, each by its own state machine. Return false if there
+ * is no endstop.
+ */
+bool StepMotor::move_to_home() {
+    ESP_LOGI(TAG, "[%d] Start homing (homing_dir=%d)", id, config->homing_dir);
+    if (is_homing())
+        stop_homing();
+    homing_error = HomingError::None;
+    if (config->endstop_pin == GPIO_NULL) {
+        fail_homing(HomingError::NoEndstop);
+        return false;
+    }
+    homing_pass = 1;
+    homing_attempt = 0;
+    set_homing_state(HomingState::Prehoming);
+    move_to_rel((unit_t)(abs(config->homing_retract_dist) * -config->homing_dir),
+                config->homing_speed);
+    return true;
+}
+
+/** Abort the homing, the motor stops */
+void StepMotor::stop_homing() {
+    if (!is_homing())
+        return;
+    agent.stop();
+    fail_homing(HomingError::Aborted);
+}
+
+bool StepMotor::is_homing() {
+    return homing_state != HomingState::Idle
+        && homing_state != HomingState::Done
+        && homing_state != HomingState::Failed;
 }
 
+const char* StepMotor::get_homing_state_name() {
+    return homing_state_names[(int)homing_state];
+}
+
+void StepMotor::set_homing_state(HomingState state) {
+    homing_state = state;
+    trace(TraceEvent::Homing, (int32_t)homing_error, (uint16_t)state);
+    ESP_LOGI(TAG, "[%d] Homing [%s] pass %d", id, get_homing_state_name(), homing_pass);
+}
+
+void StepMotor::fail_homing(HomingError error) {
+    homing_error = error;
+    homing_state = HomingState::Failed;
+    trace(TraceEvent::Homing, (int32_t)error, (uint16_t)homing_state);
+    ESP_LOGE(TAG, "[%d] Homing [failed] pass %d error %d", id, homing_pass, (int)error);
+}
+
+/**
+ * Move to the endstop, it stops the motor. The first pass is fast,
+ * the second one finds the precise position.
+ */
+void StepMotor::seek_endstop() {
+    unit_t distance, velocity;
+    if (homing_pass == 1) {
+        distance = 5 * abs(config->position_max);
+        velocity = config->homing_speed;
+    } else {
+        distance = 2 * abs(config->homing_retract_dist);
+        velocity = config->second_homing_speed;
+    }
+    set_homing_state(HomingState::Seek);
+    agent.move_to(get_state().position + config->units_to_steps(distance * config->homing_dir),
+                  velocity, true);
+}
+
+/** Advance the homing when the move completes */
+void StepMotor::update_homing(float time) {
+    switch (homing_state) {
+    case HomingState::Prehoming:
+        if (!is_moving())
+            seek_endstop();
+        break;
+    case HomingState::Seek:
+        if (is_moving())
+            break;
+        steps_t latched;
+        if (!get_endstop_latch(latched)) {
+            fail_homing(HomingError::NoEndstop);
+            break;
+        }
+        homing_wait_until = time + MOTOR_ENDSTOP_DEBOUNCE_MS / 1000.0f;
+        set_homing_state(HomingState::Debounce);
+        break;
+    case HomingState::Debounce:
+        if (time < homing_wait_until)
+            break;
+        if (!get_endpoint()) {
+            // The edge was a glitch, seek again
+            ESP_LOGW(TAG, "[%d] Endstop glitch at %d", id, (int)endstop_position);
+            if (++homing_attempt >= MOTOR_HOMING_ATTEMPTS)
+                fail_homing(HomingError::Glitch);
+            else
+                seek_endstop();
+        } else if (homing_pass == 1) {
+            homing_pass = 2;
+            homing_attempt = 0;
+            set_homing_state(HomingState::Retract);
+            move_to_rel((unit_t)(abs(config->homing_retract_dist) * -config->homing_dir),
+                        config->homing_speed);
+        } else {
+            // The latched step is the endstop position
+            auto overrun = get_state().position - endstop_position;
+            set_position(config->units_to_steps(config->position_endstop) + overrun);
+            set_homing_state(HomingState::Done);
+        }
+        break;
+    case HomingState::Retract:
+        if (!is_moving())
+            seek_endstop();
+        break;
+    default:
+        break;
+    }
+}
+
+// ==================================================
+// The endstop capture
+// ==================================================
+
+/** The active edge of the endstop (the GPIO ISR) */
+void StepMotor::endstop_isr() {
+    if (endstop_armed && !endstop_edge && hal.get_endpoint()) {
+        edge_position = position;
+        edge_time_us = esp_timer_get_time();
+        endstop_edge = true;
+    }
+}
+
+/**
+ * Latch the endstop when it stays active MOTOR_ENDSTOP_FILTER_US
+ * after its edge (called by ISR). The level is sampled at each
+ * step and at the idle ticks, the inactive level drops the edge as
+ * a spike. Without the interrupt the first active sample is the
+ * edge, the sampling also takes the edge the interrupt missed.
+ */
+bool IRAM_ATTR StepMotor::filter_endstop() {
+    if (!endstop_armed)
+        return false;
+    auto active = hal.get_endpoint();
+    if (!active) {
+        endstop_edge = false;
+        return false;
+    }
+    auto now = esp_timer_get_time();
+    if (!endstop_edge) {
+        edge_position = position;
+        edge_time_us = now;
+        endstop_edge = true;
+    }
+    if (now - edge_time_us < MOTOR_ENDSTOP_FILTER_US)
+        return false;
+    latch_endstop();
+    return true;
+}
+
+/**
+ * Stop at the endstop (called by ISR). The latched position is the
+ * one of the edge, the motor overruns it by the filter time.
+ */
+bool IRAM_ATTR StepMotor::check_endstop() {
+    if (!endstop_hit && !filter_endstop())
+        return false;
+    if (!agent.test_endpoint)
+        return false;
+    agent.halt();
+    return true;
+}
+
+/** Remember the position of the endstop edge */
+void IRAM_ATTR StepMotor::latch_endstop() {
+    endstop_position = edge_position;
+    endstop_time_us = edge_time_us;
+    endstop_armed = false;
+    endstop_hit = true;
+    trace(TraceEvent::Endstop, endstop_position);
+}
+
+/** Wait for the endstop (called by ISR) */
+void IRAM_ATTR StepMotor::arm_endstop(bool v) {
+    endstop_hit = false;
+    endstop_edge = false;
+    endstop_armed = v;
+    // The endstop is active already, there is no edge
+    if (v && hal.get_endpoint()) {
+        edge_position = position;
+        edge_time_us = esp_timer_get_time();
+        endstop_edge = true;
+    }
+}
+
+/** The position latched by the endstop, false if it did not trigger */
+bool StepMotor::get_endstop_latch(steps_t& pos) {
+    if (!endstop_hit)
+        return false;
+    pos = endstop_position;
+    return true;
+}
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <atomic>
 #include <string>
 #include <stdint.h>
 
+#include "esp_attr.h"
 #include "esp_timer.h"
 #include "esp_err.h"
 #include "esp_log.h"
@@ -12,8 +14,14 @@
 
 #include "time.h"
 #include "gpiolib.h"
+#include "ring_buffer.h"
+#include "seqlock.h"
 #include "typeslib.h"
+#include "motion_trace.h"
+#include "step_clock.h"
 #include "step_motor_hal.h"
+#include "step_planner.h"
+#include "step_timing.h"
 
 // Default iterrupt time when no othe
 #define TIMER_IDLE_DELAY_US 20000
@@ -23,24 +31,113 @@
 // with a timeout value less than 20us, the callback will be
 // dispatched only after approximately 20us.
 #define MINIMUM_TIMER_INTERVAL_US 20
-// Do not allow the steps with time more than this
-#define MAXIMUM_TIMER_INTERVAL_US 10000000
+// Do not allow the steps with time more than this, the fixed
+// point interval (STEP_INTERVAL_SHIFT) fits int32_t
+#define MAXIMUM_TIMER_INTERVAL_US 8000000
+// The commands from the tasks to the ISR, must be power of two
+#define STEP_MOTOR_COMMANDS_SIZE 8
+// The position triggers watched at once
+#define STEP_TRIGGERS_MAX 4
+// The triggers waiting to be watched, must be power of two
+#define STEP_TRIGGERS_SIZE 8
+// The planned segments run this time ahead of the motor, the
+// replacing move takes over after them
+#define STEP_MOTOR_PLAN_AHEAD_MS (3 * MOTOR_UPDATE_PERIOD_MS)
 
 class Menu;
 class StepMotor;
 class StepMotorConfig;
 class ShepMotorHAL;
 
-/** Move the motor to target position with given velocity */
+/** The homing steps, update() advances them */
+enum class HomingState : uint8_t {
+    Idle,
+    Prehoming,      // Leave the endstop
+    Seek,           // Move until the endstop latches
+    Debounce,       // The endstop must still be active after the stop
+    Retract,        // Back off before the slow pass
+    Done,
+    Failed
+};
+
+/** Why the homing failed */
+enum class HomingError : uint8_t { None, NoEndstop, Glitch, Aborted };
+
+/** The command of the tasks to the timer ISR */
+enum class StepCommandType : uint8_t { Move, Stop, SetPosition, TestEndpoint, ClearTriggers };
+
+/**
+ * Called by the ISR right after the step which brings the motor
+ * to the trigger position. It must be short, IRAM_ATTR and must
+ * not add the triggers.
+ */
+typedef void (*step_trigger_cb_t)(StepMotor* motor, void* arg);
+
+/** The one-shot event at the position */
+struct StepTrigger {
+    steps_t position;
+    int8_t dir;                 // The direction of the step, 0 for both
+    step_trigger_cb_t callback; // Can be null
+    void* arg;
+    volatile bool* flag;        // Set when fired, can be null
+    uint32_t seq;               // The count of the triggers added with it
+};
+
+struct StepMotorCommand {
+    StepCommandType type;
+    uint8_t tag;            // The segments of the move
+    bool flag;              // Test the endpoint
+    steps_t value;          // The target or the position
+    unit_t velocity;
+    uint32_t seq;
+    uint32_t triggers;      // The triggers added before the command
+};
+
+/**
+ * The state of the motor published by the timer ISR. The tasks
+ * read the consistent snapshot instead of the fields the ISR
+ * changes.
+ */
+struct StepMotorState {
+    steps_t position;
+    steps_t target;
+    int32_t interval;       // The last step interval, 0 when stopped
+    int8_t dir;
+    bool moving;
+    bool running;           // Executes the segments
+    uint8_t tag;            // The move of the running segments
+    uint32_t applied;       // The last applied command
+};
+
+/**
+ * The move planned when the previous one is pushed: the replaced
+ * move stops (or slows down) first, this one goes from there.
+ */
+struct StepPendingMove {
+    steps_t distance;
+    float rate;             // steps/s
+    float entry_rate;       // steps/s
+    float accel;            // steps/s^2
+    float jerk;             // steps/s^3
+    uint8_t tag;
+};
+
+/**
+ * Move the motor to target position with given velocity. The
+ * tasks send the commands, the state belongs to the ISR.
+ */
 class StepMotorAgent {
   public:
     StepMotorAgent();
     void init(StepMotor* motor);
     void move_to(unit_t pos, unit_t velocity);
-    void move_to(steps_t pos, unit_t velocity);
+    void move_to(steps_t pos, unit_t velocity, bool test_endpoint = false);
     void stop();
-    void on_step();
     void set_test_endpoint(bool v);
+    /** Called by the ISR */
+    void apply(const StepMotorCommand& cmd);
+    void on_step();
+    void halt();
 
     int id;
     StepMotor* motor;
@@ -72,21 +169,59 @@ class StepMotor  {
     bool is_moving();
 
     bool verify_timer_interval(uint64_t &interval);
+    float get_max_step_rate();
+    StepMotorState get_state();
+    uint32_t send(StepMotorCommand& cmd);
+    void wait_applied(uint32_t seq);
 
     void update_velocity(float time);
 
+    void plan_move_to(steps_t target, unit_t velocity, bool test_endpoint = false);
+    void fill_segments();
+    void start_segments();
+    bool is_running_segments();
+
     void set_origin();
+    void set_position(steps_t pos);
     void move_to(steps_t positin, unit_t velocity);
     void move_to(unit_t position, unit_t velocity);
     void move_to_rel(unit_t pos, unit_t velocity);
     void move_to_rel(steps_t pos, unit_t velocity);
-    void move_to_home();
-    void homing_task();
+    bool move_to_home();
+    void stop_homing();
+    bool is_homing();
+    const char* get_homing_state_name();
+    bool get_endstop_latch(steps_t& position);
+    void endstop_isr();
+    void arm_endstop(bool v);
+    void latch_endstop();
+    bool filter_endstop();
+    bool check_endstop();
+
+    void add_trigger(steps_t position, int8_t dir, step_trigger_cb_t callback,
+                     void* arg, volatile bool* flag = nullptr);
+    void add_trigger(unit_t position, int8_t dir, step_trigger_cb_t callback,
+                     void* arg, volatile bool* flag = nullptr);
+    void clear_triggers();
     unit_t get_position();
     unit_t get_velocity();
     unit_t get_default_velocity();
 
     void isr();
+    bool claim();
+    void release();
+    void step(int dir);
+    void count_step(int dir);
+    void apply_commands();
+    void check_triggers(int dir);
+    void drop_triggers(uint32_t count);
+    void drop_segments(uint8_t tag);
+    void switch_segments(uint8_t tag);
+    void publish();
+    /** Record the event at the current position */
+    IRAM_ATTR inline void trace(TraceEvent event, int32_t value = 0, uint16_t arg = 0) {
+        MotionTrace::instance.record((TraceAxis)id, event, position, value, arg);
+    }
 
 
     /** The motor's ID */
@@ -98,24 +233,97 @@ class StepMotor  {
     StepMotorAgent agent;
 
     /** Control containes requested state */
-    unit_t target_velocity;
+    std::atomic<unit_t> target_velocity;
     bool enabled;
     float speed;
 
+    /** The planned motion executed by ISR */
+    StepPlanner planner;
+    StepSegmentQueue segments;
+    StepSegment segment;
+    /** The position of the first step of the plan */
+    steps_t plan_start;
+    /** The move of the last pushed segments */
+    uint8_t queued_tag;
+    StepPendingMove pending;
+    bool has_pending;
+
+    /**
+     * The tasks talk to the ISR by the command channel and read
+     * its state by the snapshot. The mutex serializes the tasks
+     * (the channel has single producer), the ISR never waits.
+     */
+    RingBuffer<StepMotorCommand, STEP_MOTOR_COMMANDS_SIZE> commands;
+    SeqLock<StepMotorState> state;
+    SemaphoreHandle_t control_mutex;
+    uint32_t command_seq;
+    uint8_t move_tag;
+
     /** Status display the actual state of motor */
     unit_t velocity;
+    unit_t acceleration;
+
+    /** The position triggers: the tasks add them, the ISR fires */
+    RingBuffer<StepTrigger, STEP_TRIGGERS_SIZE> new_triggers;
+    uint32_t triggers_added;
+    StepTrigger triggers[STEP_TRIGGERS_MAX];
+    int triggers_armed;
+    uint32_t triggers_taken;
+
+    /**
+     * The endstop edge: the GPIO ISR takes the position of the
+     * edge, the timer ISR latches it when the endstop stays active
+     * the filter time and stops the motor before the next step
+     */
+    bool endstop_irq;
+    std::atomic<bool> endstop_armed;
+    std::atomic<bool> endstop_edge;
+    std::atomic<bool> endstop_hit;
+    steps_t edge_position;
+    int64_t edge_time_us;
+    steps_t endstop_position;
+    int64_t endstop_time_us;
+
+    /**
+     * The DDA claims the axis for its blocks. While claimed the
+     * motor ISR does not touch the position, the triggers and the
+     * state, so they have one writer at a time.
+     */
+    std::atomic<bool> claimed;
+    std::atomic<bool> isr_active;
+
+    /** Owned by the ISR */
     steps_t position;
+    uint8_t active_tag;
+    uint8_t next_tag;       // Takes over at its first segment
+    int32_t last_interval;
+    int8_t last_dir;
+    uint32_t applied_seq;
+    StepPhase phase;
 
     /** System */
     int log;
     uint32_t isr_count;
-    esp_timer_handle_t timer_handle;
-    esp_timer_create_args_t timer_arg;
+    StepTiming timing;
+    StepClock* clock;
     float previous_update_at;
-    uint64_t timer_interval_us;
     float delta_time;
+    /** The velocity controller tells the ISR the interval and direction */
+    std::atomic<uint32_t> timer_interval;   // fixed point us
+    std::atomic<int8_t> run_dir;
+
+    /** The homing progress, only update() changes it */
+    HomingState homing_state;
+    HomingError homing_error;
+    int homing_pass;
+    int homing_attempt;
+    float homing_wait_until;
 
-    /** Threads */
-    TaskHandle_t homing_task_handle;
+  private:
+    void tick();
+    void update_homing(float time);
+    void set_homing_state(HomingState state);
+    void fail_homing(HomingError error);
+    void seek_endstop();
 
 };
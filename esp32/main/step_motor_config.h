@@ -3,6 +3,10 @@
 
 #include "gpiolib.h"
 #include "typeslib.h"
+#include "step_clock.h"
+#include "step_planner.h"
+#include "step_pulse.h"
+#include "step_units.h"
 
 
 class StepMotorConfig {
@@ -18,6 +22,11 @@ class StepMotorConfig {
   bool step_pin_reverse;
   bool enable_pin_reverse;
   bool endstop_pin_reverse;
+  StepPulseType pulse_type;
+  int pulse_channel;
+  /** The step ISR engine */
+  StepClockType clock_type;
+  int clock_index;
 
   /** Kinematic settings */
   unit_t max_velocity;
@@ -29,6 +38,12 @@ class StepMotorConfig {
   unit_t position_endstop;
   unit_t position_max;
 
+  /** Motion settings */
+  bool use_planner;
+  AccelProfile accel_profile;
+  unit_t max_jerk;
+  unit_t junction_velocity;
+
   /** Homing settings */
   unit_t homing_speed;
   unit_t homing_retract_dist;
@@ -38,6 +53,8 @@ class StepMotorConfig {
   /** Config */
   double distance_per_step;
   int microsteps_per_turn;
+  /** The exact steps per unit */
+  StepRatio ratio;
 
   StepMotorConfig();
 
@@ -1,7 +1,10 @@
+#include "esp_attr.h"
+
 #include "config.h"
 #include "step_motor_hal.h"
 #include "step_motor.h"
 #include "step_motor_config.h"
+#include "step_pulse.h"
 #include "gpiolib.h"
 
 static const char TAG[] = "motor-hal";
@@ -18,7 +21,21 @@ static const char TAG[] = "motor-hal";
 /** The GPIO driver of the StepMotor         */
 /** ******************************************/
 
-StepMotorHAL::StepMotorHAL() {}
+StepMotorHAL::StepMotorHAL()
+  : pulser(nullptr)
+  , direction(false) {}
+
+/** The backend of the config, the RMT is only on the target */
+static StepPulse* create_pulse(StepMotorConfig* config) {
+#ifdef ESP_PLATFORM
+  if (config->pulse_type == StepPulseType::Rmt)
+    return new RmtStepPulse(config->pulse_channel);
+#else
+  if (config->pulse_type == StepPulseType::Rmt)
+    ESP_LOGW(TAG, "[%d] No RMT, use GPIO step pulse", config->id);
+#endif
+  return new GpioStepPulse();
+}
 
 void StepMotorHAL::init(StepMotor* motor) {
   id = motor->id;
@@ -28,6 +45,31 @@ void StepMotorHAL::init(StepMotor* motor) {
   set_gpio_oc(config->dir_pin);
   set_gpio_oc(config->enable_pin);
   set_gpio_in(config->endstop_pin);
+  direction = config->dir_pin != GPIO_NULL
+    && (bool)gpio_get_level(config->dir_pin) != config->dir_pin_reverse;
+  set_pulse(create_pulse(config));
+}
+/** Replace the step pulse backend, the HAL owns it */
+void StepMotorHAL::set_pulse(StepPulse* backend) {
+  if (pulser != nullptr)
+    delete pulser;
+  pulser = backend;
+  pulser->init(config);
+}
+/** Make the step pulse after the direction setup time */
+void IRAM_ATTR StepMotorHAL::pulse(uint32_t setup_us) {
+  pulser->pulse(setup_us);
+}
+/** Add the step pin to the batch, false if the backend makes own pulse */
+bool IRAM_ATTR StepMotorHAL::add_step(GpioBatch& batch) {
+  return pulser->add_pulse(batch);
+}
+/** Make the pulses by the batch while the DDA drives the axis */
+void IRAM_ATTR StepMotorHAL::set_batched(bool v) {
+  pulser->set_batched(v);
+}
+int32_t StepMotorHAL::min_pulse_period() {
+  return pulser->min_period_us();
 }
 bool StepMotorHAL::get_enable() {
   if (config->enable_pin != GPIO_NULL)
@@ -40,25 +82,47 @@ void StepMotorHAL::set_enable(bool v) {
   if (config->enable_pin != GPIO_NULL)
     set_gpio(config->enable_pin, v != config->enable_pin_reverse);
 }
-bool StepMotorHAL::get_direction() {
-  if (config->dir_pin != GPIO_NULL)
-    return (bool)gpio_get_level(config->dir_pin) != config->dir_pin_reverse;
-
-  return false;
+bool IRAM_ATTR StepMotorHAL::get_direction() {
+  return direction;
 }
-void StepMotorHAL::set_direction(bool v) {
+void IRAM_ATTR StepMotorHAL::set_direction(bool v) {
   PRINT_LOG("set_direction",v);
+  direction = v;
   if (config->dir_pin != GPIO_NULL)
-    set_gpio(config->dir_pin, v != config->dir_pin_reverse);
+    write_gpio(config->dir_pin, v != config->dir_pin_reverse);
+}
+/** Add the direction pin to the batch, true if it changes */
+bool IRAM_ATTR StepMotorHAL::add_direction(GpioBatch& batch, bool v) {
+  auto changed = v != direction;
+  direction = v;
+  batch.write(config->dir_pin, v != config->dir_pin_reverse);
+  return changed;
 }
 void StepMotorHAL::set_step(bool v) {
   PRINT_LOG("set_step",v);
   if (config->step_pin != GPIO_NULL)
     set_gpio(config->step_pin, v != config->step_pin_reverse);
 }
-bool StepMotorHAL::get_endpoint() {
+bool IRAM_ATTR StepMotorHAL::get_endpoint() {
   if (config->endstop_pin != GPIO_NULL)
-    return (bool)gpio_get_level(config->endstop_pin) != config->endstop_pin_reverse;
+    return (bool)read_gpio(config->endstop_pin) != config->endstop_pin_reverse;
 
   return false;
 }
+/** Call the handler at the active edge of the endstop pin */
+bool StepMotorHAL::init_endstop_interrupt(void (*handler)(void*), void* arg) {
+  if (config->endstop_pin == GPIO_NULL)
+    return false;
+  // The input controller may have installed the service already
+  auto err = gpio_install_isr_service(0);
+  if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+    ESP_LOGE(TAG, "[%d] The GPIO ISR service fails: %d", id, err);
+    return false;
+  }
+  auto edge = config->endstop_pin_reverse ? GPIO_INTR_NEGEDGE : GPIO_INTR_POSEDGE;
+  ESP_ERROR_CHECK(gpio_set_intr_type(config->endstop_pin, edge));
+  ESP_ERROR_CHECK(gpio_isr_handler_add(config->endstop_pin, handler, arg));
+  ESP_ERROR_CHECK(gpio_intr_enable(config->endstop_pin));
+  ESP_LOGI(TAG, "[%d] Endstop interrupt", id);
+  return true;
+}
@@ -1,10 +1,17 @@
 #ifndef STEP_MOTOR_HAL_H_
 #define STEP_MOTOR_HAL_H_
 
+#include <stdint.h>
+
 class StepMotorConfig;
 class StepMotor;
+class StepPulse;
+struct GpioBatch;
 
-/** The basic motor control with GPIO pins */
+/**
+ * The basic motor control with GPIO pins. The step pulse is
+ * made by the pluggable backend.
+ */
 class StepMotorHAL {
  public:
   StepMotorHAL();
@@ -16,9 +23,19 @@ class StepMotorHAL {
   void set_direction(bool);
   void set_step(bool);
   bool get_endpoint();
+  bool init_endstop_interrupt(void (*handler)(void*), void* arg);
+  void pulse(uint32_t setup_us);
+  bool add_direction(GpioBatch& batch, bool v);
+  bool add_step(GpioBatch& batch);
+  void set_batched(bool v);
+  void set_pulse(StepPulse* backend);
+  int32_t min_pulse_period();
 
   int id;
   StepMotorConfig* config;
+  StepPulse* pulser;
+  /** The level of the direction pin, the ISR does not read the pin */
+  bool direction;
 };
 
 
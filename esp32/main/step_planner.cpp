@@ -0,0 +1,430 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "step_planner.h"
+
+/** ******************************************/
+/** The planner                              */
+/** ******************************************/
+
+StepPlanner::StepPlanner()
+    : mode(AccelProfile::Linear)
+    , tag(0)
+    , min_interval(1)
+    , max_interval(10000000)
+    , dir(1)
+    , emitted(0)
+{
+    profile.steps = 0;
+    profile.accel_steps = 0;
+    profile.decel_steps = 0;
+    profile.jerk = 0;
+}
+
+void StepPlanner::reset() {
+    profile.steps = 0;
+    emitted = 0;
+}
+
+/**
+ * Start new move. The distance is signed, the rates are positive.
+ * The jerk is used only by the S-curve mode.
+ */
+void StepPlanner::plan(steps_t distance, float rate, float accel,
+                       float entry_rate, float exit_rate, float jerk) {
+    dir = distance < 0 ? -1 : 1;
+    if (mode != AccelProfile::SCurve)
+        jerk = 0;
+    compute_profile(profile, abs(distance), rate, accel, entry_rate, exit_rate, jerk);
+    emitted = 0;
+}
+
+/**
+ * Push segments to the queue until it full, return pushed quantity.
+ * The segments stop at the step `until`, so the queue does not run
+ * far ahead of the motor and the next move takes over soon.
+ */
+int StepPlanner::fill(StepSegmentQueue& queue, steps_t until) {
+    auto count = 0;
+    while (!is_done() && emitted < until && !queue.is_full()) {
+        int32_t ramp = 0;
+        auto end = mode == AccelProfile::PerStep ? next_ramp_end(emitted, ramp)
+                                                 : next_segment_end(emitted);
+        end = end > until ? until : end;
+        // The interval after the final step is never used
+        auto last = (end == profile.steps && end - emitted > 1) ? end - 2 : end - 1;
+        StepSegment seg;
+        seg.steps = end - emitted;
+        seg.dir = dir;
+        seg.interval = to_interval(step_interval(profile, emitted));
+        // The recurrence goes by the whole index from the rest, the
+        // interval of the rounded rate would drift along the ramp
+        if (ramp > 0)
+            seg.interval = to_interval(rest_interval(profile.accel, ramp - 1));
+        else if (ramp < 0)
+            seg.interval = to_interval(rest_interval(profile.accel, -ramp));
+        seg.delta = 0;
+        seg.ramp = ramp;
+        seg.rest = 0;
+        seg.flags = (emitted == 0 ? STEP_SEGMENT_FIRST : 0)
+                  | (end == profile.steps ? STEP_SEGMENT_LAST : 0);
+        seg.tag = tag;
+        if (ramp == 0 && last > emitted) {
+            auto last_interval = to_interval(step_interval(profile, last));
+            seg.delta = (int32_t)lroundf((float)(last_interval - seg.interval) / (float)(last - emitted));
+            // The interval of the ramp is convex, its chord makes
+            // each segment late. The slope is fitted to the ideal
+            // time of the segment instead, so the error does not
+            // add up from segment to segment
+            auto k = (int64_t)(last - emitted + 1);
+            auto duration = (ideal_step_time(profile, last + 1) - ideal_step_time(profile, emitted))
+                          * 1000000.0 * STEP_INTERVAL_ONE;
+            auto delta = (int32_t)llround(2 * (duration - k * seg.interval) / (k * (k - 1)));
+            if (seg.interval + (k - 1) * delta >= to_interval(0))
+                seg.delta = delta;
+        }
+        queue.push(seg);
+        emitted = end;
+        count++;
+    }
+    return count;
+}
+
+/** The rate at the end of the pushed segments, the next move starts by it */
+float StepPlanner::emitted_rate() const {
+    if (emitted >= profile.steps)
+        return emitted > 0 ? profile.exit_rate : 0;
+    return step_rate(profile, emitted);
+}
+
+/** The steps of the move in `sec` at most, it never goes faster than the cruise */
+steps_t StepPlanner::ahead_steps(float sec) const {
+    return (steps_t)ceilf(fmaxf(profile.entry_rate, profile.cruise_rate) * sec) + 1;
+}
+
+/** The steps to change the rate between `v0` and `v1` by the ramp of the mode */
+float StepPlanner::ramp_distance(float v0, float v1, float accel, float jerk) const {
+    auto lo = fminf(v0, v1);
+    auto hi = fmaxf(v0, v1);
+    if (accel <= 0)
+        return 0;
+    if (mode == AccelProfile::SCurve && jerk > 0)
+        return scurve_distance(lo, hi, accel, jerk);
+    return (hi * hi - lo * lo) / (2 * accel);
+}
+
+/** The fixed point interval, it is limited by the whole microseconds */
+int32_t StepPlanner::to_interval(float sec) {
+    auto us = (double)sec * 1000000.0;
+    us = us < min_interval ? min_interval : (us > max_interval ? max_interval : us);
+    return (int32_t)llround(us * STEP_INTERVAL_ONE);
+}
+
+/** Find the end of segment starting at the step `from` */
+steps_t StepPlanner::next_segment_end(steps_t from) {
+    auto& p = profile;
+    steps_t end;
+    if (p.accel <= 0) {
+        end = p.steps;
+    } else if (p.jerk > 0) {
+        end = ramp_segment_end(from, next_scurve_end(from));
+    } else if (from < p.accel_steps) {
+        // Accelerate until the rate grow by the ratio
+        auto rate = fmaxf(step_rate(p, from), step_rate(p, 1)) * STEP_SEGMENT_RATE_RATIO;
+        end = (steps_t)ceilf((rate * rate - p.entry_rate * p.entry_rate) / (2 * p.accel));
+        end = ramp_segment_end(from, end > p.accel_steps ? p.accel_steps : end);
+    } else if (from < p.decel_starts()) {
+        end = p.decel_starts();
+    } else {
+        // Decelerate until the rate fall by the ratio
+        auto rate = step_rate(p, from) / STEP_SEGMENT_RATE_RATIO;
+        auto cruise = p.cruise_rate;
+        end = p.decel_starts() + (steps_t)ceilf((cruise * cruise - rate * rate) / (2 * p.accel));
+        end = ramp_segment_end(from, end > p.steps ? p.steps : end);
+    }
+    return end <= from ? from + 1 : end;
+}
+
+/** Limit the steps of the ramp segment, the cruise is exact by any length */
+steps_t StepPlanner::ramp_segment_end(steps_t from, steps_t end) {
+    auto& p = profile;
+    if (from >= p.accel_steps && from < p.decel_starts())
+        return end;
+    return end - from > STEP_SEGMENT_RAMP_STEPS ? from + STEP_SEGMENT_RAMP_STEPS : end;
+}
+
+/** Find the end of segment for the S-curve ramps */
+steps_t StepPlanner::next_scurve_end(steps_t from) {
+    auto& p = profile;
+    if (from < p.accel_steps) {
+        auto rate = fmaxf(step_rate(p, from), step_rate(p, 1)) * STEP_SEGMENT_RATE_RATIO;
+        if (rate >= p.cruise_rate)
+            return p.accel_steps;
+        auto end = (steps_t)ceilf(scurve_distance_at_rate(p.entry_rate, p.cruise_rate,
+                                                          p.accel, p.jerk, rate));
+        return end > p.accel_steps ? p.accel_steps : end;
+    } else if (from < p.decel_starts()) {
+        return p.decel_starts();
+    }
+    // The deceleration is the mirrored ramp from the exit rate
+    auto rate = step_rate(p, from) / STEP_SEGMENT_RATE_RATIO;
+    if (rate <= p.exit_rate)
+        return p.steps;
+    auto left = scurve_distance_at_rate(p.exit_rate, p.cruise_rate, p.accel, p.jerk, rate);
+    auto end = p.decel_starts() + (steps_t)ceilf(p.decel_steps - left);
+    return end > p.steps ? p.steps : end;
+}
+
+/**
+ * Find the end of segment for the per step profile. Each ramp is
+ * single segment, except the steps near zero rate where the
+ * recurrence is not precise. Those made by the linear segments.
+ */
+steps_t StepPlanner::next_ramp_end(steps_t from, int32_t& ramp) {
+    auto& p = profile;
+    ramp = 0;
+    if (p.accel <= 0)
+        return p.steps;
+    // The ramp index of the rest position for the step `from`
+    auto to_index = [&](float rate) {
+        return (int32_t)lroundf(rate * rate / (2 * p.accel));
+    };
+    if (from < p.accel_steps) {
+        auto index = to_index(p.entry_rate) + from;
+        if (index + 1 < STEP_RAMP_MIN_INDEX)
+            return next_segment_end(from);
+        ramp = index + 1;
+        return p.accel_steps;
+    } else if (from < p.decel_starts()) {
+        return p.decel_starts();
+    }
+    // Stop the recurrence before the rest position
+    auto index = to_index(p.cruise_rate) - (from - p.decel_starts());
+    auto end = from + index - STEP_RAMP_MIN_INDEX;
+    if (end <= from)
+        return next_segment_end(from);
+    ramp = -(index - 1);
+    return end > p.steps ? p.steps : end;
+}
+
+// ==================================================
+// The profile math
+// ==================================================
+
+/**
+ * Make the trapezoid (or triangle) for given steps quantity. With
+ * the jerk the ramps are S-curves. When the S-curve can not reach
+ * the exit rate in given steps the profile falls back to the
+ * constant acceleration ramps.
+ */
+void StepPlanner::compute_profile(StepProfile& p, steps_t steps, float rate,
+                                  float accel, float entry_rate, float exit_rate,
+                                  float jerk) {
+    p.steps = steps;
+    p.accel = accel;
+    p.jerk = 0;
+    p.cruise_rate = rate;
+    p.entry_rate = fminf(entry_rate, rate);
+    p.exit_rate = fminf(exit_rate, rate);
+    if (accel <= 0 || steps == 0) {
+        p.accel_steps = 0;
+        p.decel_steps = 0;
+        return;
+    }
+    if (jerk > 0) {
+        auto length = [&](float vc) {
+            return scurve_distance(p.entry_rate, vc, accel, jerk)
+                 + scurve_distance(p.exit_rate, vc, accel, jerk);
+        };
+        auto lo = fmaxf(p.entry_rate, p.exit_rate);
+        if (length(lo) <= steps) {
+            // Find the highest cruise rate which fits
+            auto vc = rate;
+            if (length(rate) > steps) {
+                auto hi = rate;
+                for (auto i = 0; i < STEP_SCURVE_ITERATIONS; i++) {
+                    auto mid = 0.5f * (lo + hi);
+                    if (length(mid) > steps)
+                        hi = mid;
+                    else
+                        lo = mid;
+                }
+                vc = lo;
+            }
+            p.jerk = jerk;
+            p.cruise_rate = vc;
+            p.accel_steps = (steps_t)floorf(scurve_distance(p.entry_rate, vc, accel, jerk));
+            p.decel_steps = (steps_t)floorf(scurve_distance(p.exit_rate, vc, accel, jerk));
+            if (p.accel_steps + p.decel_steps > steps)
+                p.decel_steps = steps - p.accel_steps;
+            return;
+        }
+    }
+    auto v0 = p.entry_rate * p.entry_rate;
+    auto v1 = p.exit_rate * p.exit_rate;
+    auto vc = rate * rate;
+    auto accel_steps = (steps_t)floorf((vc - v0) / (2 * accel));
+    auto decel_steps = (steps_t)floorf((vc - v1) / (2 * accel));
+    if (accel_steps + decel_steps > steps) {
+        // There is no time for cruise, make the triangle
+        accel_steps = (steps_t)floorf((2 * accel * steps + v1 - v0) / (4 * accel));
+        accel_steps = accel_steps < 0 ? 0 : (accel_steps > steps ? steps : accel_steps);
+        decel_steps = steps - accel_steps;
+    }
+    p.accel_steps = accel_steps;
+    p.decel_steps = decel_steps;
+    p.cruise_rate = sqrtf(v0 + 2 * accel * accel_steps);
+}
+
+/** The rate (steps/s) at the step `n` */
+float StepPlanner::step_rate(const StepProfile& p, steps_t n) {
+    if (p.accel <= 0)
+        return p.cruise_rate;
+    if (p.jerk > 0) {
+        float v, s;
+        if (n < p.accel_steps) {
+            auto t = scurve_time_at(p.entry_rate, p.cruise_rate, p.accel, p.jerk, n);
+            scurve_at(p.entry_rate, p.cruise_rate, p.accel, p.jerk, t, v, s);
+            return v;
+        }
+        if (n < p.decel_starts())
+            return p.cruise_rate;
+        auto left = p.steps - n;
+        auto t = scurve_time_at(p.exit_rate, p.cruise_rate, p.accel, p.jerk, left);
+        scurve_at(p.exit_rate, p.cruise_rate, p.accel, p.jerk, t, v, s);
+        return v;
+    }
+    if (n < p.accel_steps)
+        return sqrtf(p.entry_rate * p.entry_rate + 2 * p.accel * n);
+    if (n < p.decel_starts())
+        return p.cruise_rate;
+    auto s = n - p.decel_starts();
+    auto v = p.cruise_rate * p.cruise_rate - 2 * p.accel * s;
+    return v > 0 ? sqrtf(v) : 0;
+}
+
+/** The time between the step `n` and the next one (seconds) */
+float StepPlanner::step_interval(const StepProfile& p, steps_t n) {
+    // The S-curve rate is nearly zero at the ramp begin,
+    // so the average rate is not precise there
+    if (p.jerk > 0)
+        return (float)(ideal_step_time(p, n + 1) - ideal_step_time(p, n));
+    // Use the average of the rates, it does not lose precision
+    // as the difference of two square roots does
+    auto sum = step_rate(p, n) + step_rate(p, n + 1);
+    return sum > 0 ? 2.0f / sum : 0;
+}
+
+/** The time between the steps `n` and `n + 1` from the rest (seconds) */
+float StepPlanner::rest_interval(float accel, int32_t n) {
+    return (float)(sqrt(2.0 / accel) * (sqrt((double)n + 1) - sqrt((double)n)));
+}
+
+/** The reference time of the step `n` from the move begin (seconds) */
+double StepPlanner::ideal_step_time(const StepProfile& p, steps_t n) {
+    double a = p.accel;
+    double v0 = p.entry_rate;
+    double vc = p.cruise_rate;
+    if (a <= 0)
+        return vc > 0 ? n / vc : 0;
+    if (p.jerk > 0) {
+        auto ramp = [&](float from, float dist) {
+            return (double)scurve_time_at(from, p.cruise_rate, p.accel, p.jerk, dist);
+        };
+        if (n <= p.accel_steps)
+            return ramp(p.entry_rate, n);
+        auto t_accel = ramp(p.entry_rate, p.accel_steps);
+        if (n <= p.decel_starts())
+            return t_accel + (n - p.accel_steps) / vc;
+        auto t_decel = t_accel + (p.decel_starts() - p.accel_steps) / vc;
+        return t_decel + ramp(p.exit_rate, p.decel_steps) - ramp(p.exit_rate, p.steps - n);
+    }
+    if (n <= p.accel_steps)
+        return (sqrt(v0 * v0 + 2 * a * n) - v0) / a;
+    auto t_accel = (vc - v0) / a;
+    if (n <= p.decel_starts())
+        return t_accel + (n - p.accel_steps) / vc;
+    auto t_decel = t_accel + (p.decel_starts() - p.accel_steps) / vc;
+    auto v = vc * vc - 2 * a * (n - p.decel_starts());
+    return t_decel + (vc - (v > 0 ? sqrt(v) : 0)) / a;
+}
+
+// ==================================================
+// The S-curve ramp
+//
+// The ramp from v0 to v1 has three phases: the acceleration
+// grows with the jerk, stays at the limit, then falls with the
+// jerk. The short ramps do not reach the acceleration limit.
+// The ramp is symmetric, so its distance is the average rate
+// multiplied by the duration.
+// ==================================================
+
+/** The duration of the ramp changing the rate by dv (seconds) */
+float StepPlanner::scurve_time(float dv, float accel, float jerk) {
+    if (dv <= 0)
+        return 0;
+    if (dv * jerk > accel * accel)
+        return dv / accel + accel / jerk;
+    return 2 * sqrtf(dv / jerk);
+}
+
+/** The distance of the ramp (steps) */
+float StepPlanner::scurve_distance(float v0, float v1, float accel, float jerk) {
+    return 0.5f * (v0 + v1) * scurve_time(v1 - v0, accel, jerk);
+}
+
+/** The rate and the distance at the time `t` from the ramp begin */
+void StepPlanner::scurve_at(float v0, float v1, float accel, float jerk,
+                            float t, float& v, float& s) {
+    auto time = scurve_time(v1 - v0, accel, jerk);
+    auto tj = fminf(accel / jerk, 0.5f * time);
+    if (t <= tj) {
+        v = v0 + 0.5f * jerk * t * t;
+        s = v0 * t + jerk * t * t * t / 6;
+    } else if (t < time - tj) {
+        auto vj = v0 + 0.5f * jerk * tj * tj;
+        auto sj = v0 * tj + jerk * tj * tj * tj / 6;
+        auto a = jerk * tj;
+        auto u = t - tj;
+        v = vj + a * u;
+        s = sj + vj * u + 0.5f * a * u * u;
+    } else {
+        // Mirror of the first phase from the ramp end
+        auto u = fmaxf(time - t, 0.0f);
+        v = v1 - 0.5f * jerk * u * u;
+        s = 0.5f * (v0 + v1) * time - (v1 * u - jerk * u * u * u / 6);
+    }
+}
+
+/** The time when the ramp passes the distance (seconds) */
+float StepPlanner::scurve_time_at(float v0, float v1, float accel, float jerk, float dist) {
+    auto lo = 0.0f;
+    auto hi = scurve_time(v1 - v0, accel, jerk);
+    for (auto i = 0; i < STEP_SCURVE_ITERATIONS; i++) {
+        float v, s;
+        auto mid = 0.5f * (lo + hi);
+        scurve_at(v0, v1, accel, jerk, mid, v, s);
+        if (s < dist)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return 0.5f * (lo + hi);
+}
+
+/** The distance where the ramp reaches the rate (steps) */
+float StepPlanner::scurve_distance_at_rate(float v0, float v1, float accel, float jerk, float rate) {
+    auto lo = 0.0f;
+    auto hi = scurve_time(v1 - v0, accel, jerk);
+    float v, s;
+    for (auto i = 0; i < STEP_SCURVE_ITERATIONS; i++) {
+        auto mid = 0.5f * (lo + hi);
+        scurve_at(v0, v1, accel, jerk, mid, v, s);
+        if (v < rate)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    scurve_at(v0, v1, accel, jerk, hi, v, s);
+    return s;
+}
@@ -0,0 +1,181 @@
+#ifndef STEP_PLANNER_H_
+#define STEP_PLANNER_H_
+
+#include <stdint.h>
+
+#include "esp_attr.h"
+
+#include "ring_buffer.h"
+#include "typeslib.h"
+
+/** The queue size, must be power of two */
+#define STEP_SEGMENT_QUEUE_SIZE 64
+/** The velocity grows (or falls) at most this times inside one segment */
+#define STEP_SEGMENT_RATE_RATIO 1.25f
+/** The ramp segment makes at most this steps, the error of the rounded delta grows by their square */
+#define STEP_SEGMENT_RAMP_STEPS 64
+
+/** The segment flags */
+#define STEP_SEGMENT_FIRST 1    // The first segment of the move
+#define STEP_SEGMENT_LAST 2     // The last segment of the move
+
+/**
+ * The intervals are fixed point microseconds with this fraction
+ * bits. The timer has whole microseconds only, the ISR carries the
+ * fraction to the next step by StepPhase.
+ */
+#define STEP_INTERVAL_SHIFT 8
+#define STEP_INTERVAL_ONE (1 << STEP_INTERVAL_SHIFT)
+
+/**
+ * The minimal ramp index where the per step recurrence is precise.
+ * From the low index the intervals stay ~0.8% long to the cruise.
+ */
+#define STEP_RAMP_MIN_INDEX 32
+
+/** The bisection iterations to invert the S-curve ramp */
+#define STEP_SCURVE_ITERATIONS 24
+
+/**
+ * How the planner makes the acceleration ramps. The S-curve
+ * ramp limits the jerk (the change of the acceleration), it is
+ * made by the linear segments.
+ */
+enum class AccelProfile { Linear, PerStep, SCurve };
+
+/**
+ * The smallest piece of the motion executed by the timer ISR.
+ * The ISR makes `steps` steps, the first one right now. After
+ * each step it waits `interval` and then adds the `delta` to the
+ * interval. Both are fixed point microseconds (STEP_INTERVAL_SHIFT).
+ *
+ * When the `ramp` is not zero the interval follows the constant
+ * acceleration recurrence (D.Austin, AVR446):
+ *
+ *     c[n] = c[n-1] - (2 * c[n-1]) / (4 * n + 1)
+ *
+ * where `ramp` is the index n. It is negative for the deceleration.
+ * The remainder of the division goes to `rest`, so the ramp does
+ * not lose the time.
+ */
+struct StepSegment {
+    steps_t steps;
+    int32_t interval;
+    int32_t delta;
+    int32_t ramp;
+    int32_t rest;
+    int8_t dir;
+    uint8_t flags;
+    uint8_t tag;            // The move the segment belongs to
+
+    /** Compute the interval of the next step (called by ISR) */
+    IRAM_ATTR inline void advance() {
+        steps--;
+        if (ramp != 0) {
+            int32_t num = 2 * interval + rest;
+            int32_t den = 4 * ramp + 1;
+            interval -= num / den;
+            rest = num % den;
+            ramp++;
+        } else {
+            interval += delta;
+        }
+    }
+};
+
+/**
+ * Converts the fixed point intervals to the timer microseconds.
+ * The truncated fraction carries to the next step, so the long run
+ * step rate is exact and the timer jitter is below 1 us.
+ */
+struct StepPhase {
+    uint32_t fraction;
+
+    inline void reset() { fraction = 0; }
+    /** The timer interval of the step (called by ISR) */
+    IRAM_ATTR inline uint32_t take(int32_t interval) {
+        auto t = (uint32_t)interval + fraction;
+        fraction = t & (STEP_INTERVAL_ONE - 1);
+        return t >> STEP_INTERVAL_SHIFT;
+    }
+};
+
+/**
+ * Ring buffer of the segments. The planner pushes the
+ * segments and the timer ISR pops them.
+ */
+typedef RingBuffer<StepSegment, STEP_SEGMENT_QUEUE_SIZE> StepSegmentQueue;
+
+/**
+ * The trapezoidal velocity profile of single move (in steps).
+ * When the jerk is not zero the ramps are the S-curves.
+ */
+struct StepProfile {
+    steps_t steps;
+    steps_t accel_steps;
+    steps_t decel_steps;
+    float entry_rate;       // steps/s
+    float cruise_rate;      // steps/s
+    float exit_rate;        // steps/s
+    float accel;            // steps/s^2
+    float jerk;             // steps/s^3
+
+    inline steps_t decel_starts() const { return steps - decel_steps; }
+};
+
+/**
+ * Converts the move to the queue of the step segments. With the
+ * linear profile each ramp is split to the segments with linear
+ * changing interval, so the ISR does not do any math except the
+ * addition. With the per step profile each ramp is single segment
+ * and the ISR updates the interval with the integer recurrence.
+ */
+class StepPlanner {
+    public:
+        StepPlanner();
+
+        void reset();
+        void plan(steps_t distance, float rate, float accel,
+                  float entry_rate = 0, float exit_rate = 0, float jerk = 0);
+        int fill(StepSegmentQueue& queue, steps_t until = INT32_MAX);
+        float emitted_rate() const;
+        steps_t ahead_steps(float sec) const;
+        float ramp_distance(float v0, float v1, float accel, float jerk) const;
+
+        inline bool is_done() { return emitted >= profile.steps; }
+        inline steps_t get_emitted() const { return emitted; }
+        inline int8_t get_dir() const { return dir; }
+
+        static void compute_profile(StepProfile& p, steps_t steps, float rate,
+                                    float accel, float entry_rate, float exit_rate,
+                                    float jerk = 0);
+        static float step_rate(const StepProfile& p, steps_t n);
+        static float step_interval(const StepProfile& p, steps_t n);
+        static double ideal_step_time(const StepProfile& p, steps_t n);
+        static float rest_interval(float accel, int32_t n);
+
+        static float scurve_time(float dv, float accel, float jerk);
+        static float scurve_distance(float v0, float v1, float accel, float jerk);
+        static void scurve_at(float v0, float v1, float accel, float jerk,
+                              float t, float& v, float& s);
+        static float scurve_time_at(float v0, float v1, float accel, float jerk, float dist);
+        static float scurve_distance_at_rate(float v0, float v1, float accel, float jerk, float rate);
+
+        StepProfile profile;
+        AccelProfile mode;
+        uint8_t tag;
+        int32_t min_interval;   // us
+        int32_t max_interval;   // us
+
+    private:
+        int32_t to_interval(float sec);
+        steps_t next_segment_end(steps_t from);
+        steps_t ramp_segment_end(steps_t from, steps_t end);
+        steps_t next_ramp_end(steps_t from, int32_t& ramp);
+        steps_t next_scurve_end(steps_t from);
+
+        int8_t dir;
+        steps_t emitted;
+};
+
+#endif // STEP_PLANNER_H_
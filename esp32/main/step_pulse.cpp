@@ -0,0 +1,142 @@
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#ifdef ESP_PLATFORM
+#include "esp_rom_gpio.h"
+#include "hal/rmt_ll.h"
+#include "soc/gpio_sig_map.h"
+#include "soc/rmt_struct.h"
+#endif
+
+#include "config.h"
+#include "step_motor_config.h"
+#include "step_pulse.h"
+
+static const char TAG[] = "step-pulse";
+
+/** ******************************************/
+/** The GPIO pulse                           */
+/** ******************************************/
+
+GpioStepPulse::GpioStepPulse()
+    : pin(GPIO_NULL)
+    , active(true)
+{}
+
+void GpioStepPulse::init(StepMotorConfig* config) {
+    pin = config->step_pin;
+    active = !config->step_pin_reverse;
+    ESP_LOGI(TAG, "[%d] GPIO step pulse", config->id);
+}
+
+void IRAM_ATTR GpioStepPulse::pulse(uint32_t setup_us) {
+    if (setup_us > 0)
+        ets_delay_us(setup_us);
+    if (pin == GPIO_NULL)
+        return;
+    write_gpio(pin, active);
+    ets_delay_us(MOTOR_STEP_PULSE_WIDTH_MS);
+    write_gpio(pin, !active);
+}
+
+bool IRAM_ATTR GpioStepPulse::add_pulse(GpioBatch& batch) {
+    batch.write(pin, active);
+    return true;
+}
+
+/** The ISR waits the pulse, the pin stays idle until the next one */
+int32_t GpioStepPulse::min_period_us() {
+    return 2 * MOTOR_STEP_PULSE_WIDTH_MS;
+}
+
+#ifdef ESP_PLATFORM
+
+/** ******************************************/
+/** The RMT pulse                            */
+/** ******************************************/
+
+/** The RMT ticks at 1 MHz (80 MHz APB / 80) */
+#define RMT_PULSE_CLK_DIV 80
+
+RmtStepPulse::RmtStepPulse(int _channel)
+    : channel((rmt_channel_t)_channel)
+    , pin(GPIO_NULL)
+    , batched(false)
+    , active(1)
+    , idle(0)
+    , loaded_setup(UINT32_MAX)
+{}
+
+void RmtStepPulse::init(StepMotorConfig* config) {
+    pin = config->step_pin;
+    active = config->step_pin_reverse ? 0 : 1;
+    idle = !active;
+    rmt_config_t rmt = RMT_DEFAULT_CONFIG_TX(config->step_pin, channel);
+    rmt.clk_div = RMT_PULSE_CLK_DIV;
+    rmt.tx_config.idle_output_en = true;
+    rmt.tx_config.idle_level = idle ? RMT_IDLE_LEVEL_HIGH : RMT_IDLE_LEVEL_LOW;
+    // No driver install, its interrupt and locks are not used
+    ESP_ERROR_CHECK(rmt_config(&rmt));
+    load(0);
+    ESP_LOGI(TAG, "[%d] RMT step pulse on channel %d", config->id, (int)channel);
+}
+
+/** Put the pulse to the channel's memory (called by ISR) */
+void IRAM_ATTR RmtStepPulse::load(uint32_t setup_us) {
+    rmt_item32_t items[2];
+    if (setup_us > 0) {
+        items[0].level0 = idle;
+        items[0].duration0 = setup_us;
+        items[0].level1 = active;
+        items[0].duration1 = MOTOR_STEP_PULSE_WIDTH_MS;
+        items[1].level0 = idle;
+        items[1].duration0 = 1;
+    } else {
+        items[0].level0 = active;
+        items[0].duration0 = MOTOR_STEP_PULSE_WIDTH_MS;
+        items[0].level1 = idle;
+        items[0].duration1 = 1;
+        items[1].level0 = idle;
+        items[1].duration0 = 0;
+    }
+    // The zero duration ends the transmission
+    items[1].level1 = idle;
+    items[1].duration1 = 0;
+    for (auto i = 0; i < 2; i++)
+        RMTMEM.chan[channel].data32[i].val = items[i].val;
+    loaded_setup = setup_us;
+}
+
+/** Restart the transmission from the first item (called by ISR) */
+void IRAM_ATTR RmtStepPulse::pulse(uint32_t setup_us) {
+    if (setup_us != loaded_setup)
+        load(setup_us);
+    rmt_ll_tx_reset_pointer(&RMT, channel);
+    rmt_ll_tx_start(&RMT, channel);
+}
+
+int32_t RmtStepPulse::min_period_us() {
+    return MOTOR_STEP_PULSE_WIDTH_MS + 1;
+}
+
+bool IRAM_ATTR RmtStepPulse::add_pulse(GpioBatch& batch) {
+    if (batched)
+        batch.write(pin, active);
+    return batched;
+}
+
+/** Switch the pin between the RMT signal and the GPIO (called by ISR) */
+void IRAM_ATTR RmtStepPulse::set_batched(bool v) {
+    if (v == batched || pin == GPIO_NULL)
+        return;
+    if (v) {
+        // The output register holds the idle level before the switch
+        write_gpio(pin, idle);
+        esp_rom_gpio_connect_out_signal(pin, SIG_GPIO_OUT_IDX, false, false);
+    } else {
+        esp_rom_gpio_connect_out_signal(pin, RMT_SIG_OUT0_IDX + channel, false, false);
+    }
+    batched = v;
+}
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef STEP_PULSE_H_
+#define STEP_PULSE_H_
+
+#include <stdint.h>
+
+#include "gpiolib.h"
+
+#ifdef ESP_PLATFORM
+#include "driver/rmt.h"
+#endif
+
+class StepMotorConfig;
+
+/** The way the step pulse is made */
+enum class StepPulseType { Gpio, Rmt };
+
+/**
+ * The backend of the step pin. The ISR sets the direction pin
+ * and asks the backend for one pulse. The pulse starts after
+ * `setup_us` (the direction setup time) and lasts the pulse width.
+ */
+class StepPulse {
+    public:
+        virtual ~StepPulse() {}
+
+        virtual void init(StepMotorConfig* config) = 0;
+        /** Make the pulse, the hardware backends return at once */
+        virtual void pulse(uint32_t setup_us) = 0;
+        /** The shortest period of the pulses (microseconds) */
+        virtual int32_t min_period_us() = 0;
+        /**
+         * Add the active level of the step pin to the batch, the
+         * caller writes all the pins together. False if the backend
+         * makes its own pulse.
+         */
+        virtual bool add_pulse(GpioBatch& batch) { return false; }
+        /**
+         * Route the step pin to the GPIO writes (true), so the
+         * pulses go by the batch, or back to the backend (false).
+         * Called by ISR.
+         */
+        virtual void set_batched(bool v) {}
+};
+
+/** The pulse by the GPIO writes and busy-wait (blocks the ISR) */
+class GpioStepPulse : public StepPulse {
+    public:
+        GpioStepPulse();
+
+        void init(StepMotorConfig* config) override;
+        void pulse(uint32_t setup_us) override;
+        int32_t min_period_us() override;
+        bool add_pulse(GpioBatch& batch) override;
+
+    private:
+        gpio_num_t pin;
+        bool active;
+};
+
+#ifdef ESP_PLATFORM
+/**
+ * The pulse timed by the RMT channel. The items of the pulse
+ * stay in the channel's memory, so the ISR only restarts the
+ * transmission and does not wait. The driver configures the
+ * channel once, the ISR writes the memory and the registers
+ * directly, because the driver calls take locks. When batched, the
+ * pin is switched from the RMT signal to the GPIO output register.
+ */
+class RmtStepPulse : public StepPulse {
+    public:
+        RmtStepPulse(int channel);
+
+        void init(StepMotorConfig* config) override;
+        void pulse(uint32_t setup_us) override;
+        int32_t min_period_us() override;
+        bool add_pulse(GpioBatch& batch) override;
+        void set_batched(bool v) override;
+
+    private:
+        void load(uint32_t setup_us);
+
+        rmt_channel_t channel;
+        gpio_num_t pin;
+        bool batched;
+        uint32_t active;
+        uint32_t idle;
+        uint32_t loaded_setup;
+};
+#endif
+
+#endif // STEP_PULSE_H_
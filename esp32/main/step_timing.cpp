@@ -0,0 +1,43 @@
+#include <stdio.h>
+
+#include "step_timing.h"
+
+/** ******************************************/
+/** The step timer statistics                */
+/** ******************************************/
+
+StepTiming::StepTiming() {
+    reset();
+}
+
+void StepTiming::reset() {
+    for (auto i = 0; i < STEP_TIMING_BUCKETS; i++)
+        histogram[i] = 0;
+    samples = 0;
+    missed = 0;
+    max_late = 0;
+    max_early = 0;
+    max_isr = 0;
+    entered_at = 0;
+    scheduled = 0;
+}
+
+/** Print the statistics to the terminal */
+void StepTiming::dump(const char* name) {
+    printf("Step timing [%s]:\n", name);
+    printf("  Samples         = %u\n", (unsigned)samples);
+    printf("  Missed          = %u (late > %d us)\n", (unsigned)missed, STEP_TIMING_MISSED_US);
+    printf("  Max late        = %d us\n", (int)max_late);
+    printf("  Max early       = %d us\n", (int)max_early);
+    printf("  Max ISR         = %d us\n", (int)max_isr);
+    printf("  Interval error histogram:\n");
+    for (auto i = 0; i < STEP_TIMING_BUCKETS; i++) {
+        auto from = (i - STEP_TIMING_BUCKETS / 2) * STEP_TIMING_BUCKET_US;
+        if (i == 0)
+            printf("    %5s .. %4d us : %u\n", "", from + STEP_TIMING_BUCKET_US, (unsigned)histogram[i]);
+        else if (i == STEP_TIMING_BUCKETS - 1)
+            printf("    %5d .. %4s us : %u\n", from, "", (unsigned)histogram[i]);
+        else
+            printf("    %5d .. %4d us : %u\n", from, from + STEP_TIMING_BUCKET_US, (unsigned)histogram[i]);
+    }
+}
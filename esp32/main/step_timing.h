@@ -0,0 +1,74 @@
+#ifndef STEP_TIMING_H_
+#define STEP_TIMING_H_
+
+#include <stdint.h>
+
+#include "esp_attr.h"
+#include "esp_timer.h"
+
+/** The histogram of the interval error */
+#define STEP_TIMING_BUCKETS 16
+#define STEP_TIMING_BUCKET_US 4
+/** The ISR came this much later than scheduled, the deadline is missed */
+#define STEP_TIMING_MISSED_US 50
+
+/**
+ * The timing statistics of the step timer ISR. The actual interval
+ * between two ISR calls is compared with the interval the previous
+ * call has scheduled. The error goes to the fixed-width histogram
+ * centered at zero, the outer buckets collect the rest.
+ */
+class StepTiming {
+    public:
+        StepTiming();
+
+        void reset();
+        void dump(const char* name);
+
+        /** Call at the begin of the ISR */
+        IRAM_ATTR inline void enter() {
+            auto now = esp_timer_get_time();
+            if (scheduled > 0) {
+                auto error = (int32_t)(now - entered_at) - scheduled;
+                // Round down, so the bucket N is [N*W .. (N+1)*W)
+                auto bucket = (error >= 0 ? error / STEP_TIMING_BUCKET_US
+                               : -((STEP_TIMING_BUCKET_US - 1 - error) / STEP_TIMING_BUCKET_US))
+                    + STEP_TIMING_BUCKETS / 2;
+                bucket = bucket < 0 ? 0 : (bucket >= STEP_TIMING_BUCKETS ? STEP_TIMING_BUCKETS - 1 : bucket);
+                histogram[bucket]++;
+                samples++;
+                if (error > max_late)
+                    max_late = error;
+                if (error < max_early)
+                    max_early = error;
+                if (error > STEP_TIMING_MISSED_US)
+                    missed++;
+            }
+            entered_at = now;
+            scheduled = 0;
+        }
+        /** Call at the end of the ISR with the scheduled interval or zero */
+        IRAM_ATTR inline void leave(uint32_t interval) {
+            auto duration = (int32_t)(esp_timer_get_time() - entered_at);
+            if (duration > max_isr)
+                max_isr = duration;
+            scheduled = interval;
+        }
+        /** The timer started out of the ISR, skip the next interval */
+        IRAM_ATTR inline void restart() {
+            scheduled = 0;
+        }
+
+        uint32_t histogram[STEP_TIMING_BUCKETS];
+        uint32_t samples;
+        uint32_t missed;
+        int32_t max_late;   // us
+        int32_t max_early;  // us
+        int32_t max_isr;    // us
+
+    private:
+        int64_t entered_at;
+        int32_t scheduled;
+};
+
+#endif // STEP_TIMING_H_
@@ -0,0 +1,90 @@
+#ifndef STEP_UNITS_H_
+#define STEP_UNITS_H_
+
+#include <stdint.h>
+
+#include "typeslib.h"
+
+/** The rotation distance is rounded to this fraction of the unit */
+#define STEP_UNITS_SCALE 10000
+
+/**
+ * The steps per unit ratio is exact rational: `STEPS` steps make
+ * exactly `UNITS` units. The conversion splits the position to
+ * the whole periods (integer math) and the rest (single float
+ * multiply by the precomputed reciprocal). So there is no double
+ * math and the large positions do not drift.
+ */
+
+constexpr int32_t step_units_gcd(int32_t a, int32_t b) {
+    return b == 0 ? a : step_units_gcd(b, a % b);
+}
+constexpr int32_t step_units_distance(unit_t rotation_distance) {
+    return (int32_t)(rotation_distance * STEP_UNITS_SCALE + 0.5f);
+}
+/** The steps in the period */
+constexpr int32_t step_units_steps(int32_t microsteps_per_turn, unit_t rotation_distance) {
+    return microsteps_per_turn * STEP_UNITS_SCALE
+        / step_units_gcd(microsteps_per_turn * STEP_UNITS_SCALE, step_units_distance(rotation_distance));
+}
+/** The units in the period */
+constexpr int32_t step_units_units(int32_t microsteps_per_turn, unit_t rotation_distance) {
+    return step_units_distance(rotation_distance)
+        / step_units_gcd(microsteps_per_turn * STEP_UNITS_SCALE, step_units_distance(rotation_distance));
+}
+
+/** Round to the nearest step, the round trip returns the same step */
+inline steps_t step_units_round(float steps) {
+    return (steps_t)(steps < 0 ? steps - 0.5f : steps + 0.5f);
+}
+
+/** The conversion with the ratio known at run time */
+struct StepRatio {
+    int32_t steps;
+    int32_t units;
+    float steps_per_unit;
+    float units_per_step;
+
+    inline void init(int32_t microsteps_per_turn, unit_t rotation_distance) {
+        steps = step_units_steps(microsteps_per_turn, rotation_distance);
+        units = step_units_units(microsteps_per_turn, rotation_distance);
+        steps_per_unit = (float)steps / (float)units;
+        units_per_step = (float)units / (float)steps;
+    }
+    inline float to_fsteps(unit_t u) const {
+        return u * steps_per_unit;
+    }
+    inline steps_t to_steps(unit_t u) const {
+        return step_units_round(u * steps_per_unit);
+    }
+    inline unit_t to_units(steps_t s) const {
+        return (unit_t)((s / steps) * units) + (s % steps) * units_per_step;
+    }
+};
+
+/**
+ * The conversion specialized at compile time. The compiler folds
+ * the ratio to the constants.
+ *
+ *     typedef StepUnits<step_units_steps(1600, 2.0f),
+ *                       step_units_units(1600, 2.0f)> XUnits;
+ */
+template<int32_t STEPS, int32_t UNITS>
+struct StepUnits {
+    static constexpr int32_t steps = STEPS;
+    static constexpr int32_t units = UNITS;
+    static constexpr float steps_per_unit = (float)STEPS / (float)UNITS;
+    static constexpr float units_per_step = (float)UNITS / (float)STEPS;
+
+    static inline float to_fsteps(unit_t u) {
+        return u * steps_per_unit;
+    }
+    static inline steps_t to_steps(unit_t u) {
+        return step_units_round(u * steps_per_unit);
+    }
+    static inline unit_t to_units(steps_t s) {
+        return (unit_t)((s / STEPS) * UNITS) + (s % STEPS) * units_per_step;
+    }
+};
+
+#endif // STEP_UNITS_H_
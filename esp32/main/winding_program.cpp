@@ -0,0 +1,115 @@
+#include <stdio.h>
+
+#include "winding_program.h"
+
+static const char op_names[6][8] = { "layer", "cross", "turn", "pause", "shift", "end" };
+
+/** ******************************************/
+/** The winding program                      */
+/** ******************************************/
+
+WindingProgram::WindingProgram()
+    : layer(0)
+    , turns(0)
+    , x_min(0)
+    , x_max(0)
+{}
+
+void WindingProgram::clear(int _layer) {
+    records.clear();
+    layer = _layer;
+    turns = 0;
+    x_min = 0;
+    x_max = 0;
+}
+
+/** Append the record and update the summary */
+void WindingProgram::add(WindOp op, int layer, float x, float r, uint8_t flags) {
+    WindRecord rec;
+    rec.op = (uint8_t)op;
+    rec.flags = flags;
+    rec.layer = (uint16_t)layer;
+    rec.x = x;
+    rec.r = r;
+    records.push_back(rec);
+    switch (op) {
+        case WindOp::Layer:
+            // The layer starts the range
+            x_min = x;
+            x_max = x;
+            break;
+        case WindOp::Turn:
+            if ((flags & WIND_FLAG_EXTRA) == 0)
+                turns++;
+            break;
+        default:
+            break;
+    }
+    // The range of the nominal job, the extra turns are optional
+    if ((op == WindOp::Cross || op == WindOp::Turn) && (flags & WIND_FLAG_EXTRA) == 0) {
+        x_min = x < x_min ? x : x_min;
+        x_max = x > x_max ? x : x_max;
+    }
+}
+
+/** The size when there is no such record */
+size_t WindingProgram::find(WindOp op, size_t from) const {
+    for (auto i = from; i < records.size(); i++) {
+        if (records[i].op == (uint8_t)op)
+            return i;
+    }
+    return records.size();
+}
+
+/** The size when the spindle only winds forward */
+size_t WindingProgram::find_reverse() const {
+    auto r = 0.0f;
+    auto moved = false;
+    for (size_t i = 0; i < records.size(); i++) {
+        auto& rec = records[i];
+        if (rec.op != (uint8_t)WindOp::Layer && rec.op != (uint8_t)WindOp::Cross
+            && rec.op != (uint8_t)WindOp::Turn)
+            continue;
+        if (moved && rec.r < r)
+            return i;
+        r = rec.r;
+        moved = true;
+    }
+    return records.size();
+}
+
+/** CRC-32 (IEEE) of the records */
+uint32_t WindingProgram::checksum(uint32_t crc) const {
+    auto data = (const uint8_t*)records.data();
+    auto size = records.size() * sizeof(WindRecord);
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc ^= data[i];
+        for (auto bit = 0; bit < 8; bit++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+    }
+    return ~crc;
+}
+
+/** Print the summary to the terminal */
+void WindingProgram::inspect() const {
+    printf("Winding program layer %d:\n", layer);
+    printf("  Records         = %d (%d bytes)\n", (int)records.size(),
+           (int)(records.size() * sizeof(WindRecord)));
+    printf("  Turns           = %d\n", turns);
+    printf("  X range         = %.2f .. %.2f mm\n", x_min, x_max);
+    printf("  Checksum        = %08X\n", (unsigned)checksum());
+}
+
+/** Print each record to the terminal */
+void WindingProgram::dump() const {
+    for (size_t i = 0; i < records.size(); i++) {
+        auto& rec = records[i];
+        printf("%5d %-5s L%-3d %c%c%c x: %8.3f r: %9.3f\n", (int)i,
+               rec.op < 6 ? op_names[rec.op] : "?", (int)rec.layer,
+               (rec.flags & WIND_FLAG_FORWARD) ? 'F' : '-',
+               (rec.flags & WIND_FLAG_EXTRA) ? 'E' : '-',
+               (rec.flags & WIND_FLAG_CONTINUOUS) ? 'C' : '-',
+               rec.x, rec.r);
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef WINDING_PROGRAM_H_
+#define WINDING_PROGRAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/** The layer goes to +X */
+#define WIND_FLAG_FORWARD 0x01
+/** The turn beyond the layer, the operator winds it by click */
+#define WIND_FLAG_EXTRA 0x02
+/** The spindle winds the layer without stops, X follows it by the gear */
+#define WIND_FLAG_CONTINUOUS 0x04
+
+/**
+ * The record operation. It tells the meaning of the fields:
+ *
+ *   Layer   layer, x r = the start of the layer, flags = FORWARD CONTINUOUS
+ *   Cross   layer, x r = the crossover move of the turn, flags = EXTRA
+ *   Turn    layer, x r = the end of the turn, flags = EXTRA
+ *   Pause   layer, the operator makes each next turn by click
+ *   Shift   layer, x = the shift to the next layer (relative)
+ *   End     -
+ *
+ * The positions are absolute (mm and turns) for the nominal job
+ * where each layer has its turns exactly. In the continuous layer
+ * each turn has two Cross records: the start and the end of the
+ * crossover arc.
+ */
+enum class WindOp : uint8_t { Layer, Cross, Turn, Pause, Shift, End };
+
+/** The compact record of the program */
+struct WindRecord {
+    uint8_t op;
+    uint8_t flags;
+    uint16_t layer;
+    float x;
+    float r;
+};
+
+static_assert(sizeof(WindRecord) == 12, "The record is 12 bytes");
+
+/**
+ * One layer of the coil job as the array of records. The coil
+ * compiles the layer when the winding task comes to it, so the
+ * memory is bounded by the layer and not by the job. Before the
+ * start the coil compiles the layers one by one to inspect and
+ * checksum the job before the wire touches the bobbin.
+ */
+class WindingProgram {
+    public:
+        WindingProgram();
+
+        void clear(int layer);
+        void add(WindOp op, int layer, float x = 0, float r = 0, uint8_t flags = 0);
+        /** Find the next record of the operation from the index */
+        size_t find(WindOp op, size_t from) const;
+        /** Find the first move record behind the R of the moves before it */
+        size_t find_reverse() const;
+        /** CRC-32 of the records, it continues the `crc` of the layers before */
+        uint32_t checksum(uint32_t crc = 0) const;
+        void inspect() const;
+        void dump() const;
+
+        inline size_t size() const { return records.size(); }
+        inline const WindRecord* data() const { return records.data(); }
+        inline const WindRecord& operator[](size_t i) const { return records[i]; }
+
+        int layer;
+        int turns;
+        float x_min;
+        float x_max;
+
+    private:
+        std::vector<WindRecord> records;
+};
+
+#endif // WINDING_PROGRAM_H_